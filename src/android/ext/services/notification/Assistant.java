@@ -28,44 +28,56 @@ import android.app.ActivityThread;
 import android.app.INotificationManager;
 import android.app.Notification;
 import android.app.NotificationChannel;
+import android.content.BroadcastReceiver;
 import android.content.Context;
+import android.content.Intent;
+import android.content.IntentFilter;
 import android.content.pm.IPackageManager;
-import android.os.AsyncTask;
 import android.os.Bundle;
 import android.os.Environment;
+import android.os.Handler;
+import android.os.HandlerThread;
+import android.os.Process;
+import android.os.SystemClock;
 import android.os.UserHandle;
 import android.os.storage.StorageManager;
 import android.service.notification.Adjustment;
 import android.service.notification.NotificationAssistantService;
 import android.service.notification.NotificationStats;
 import android.service.notification.StatusBarNotification;
-import android.util.ArrayMap;
+import android.util.ArraySet;
 import android.util.AtomicFile;
 import android.util.Log;
 import android.util.Slog;
 import android.util.Xml;
+import android.util.proto.ProtoOutputStream;
 
 import com.android.internal.annotations.VisibleForTesting;
-import com.android.internal.util.FastXmlSerializer;
+import com.android.internal.util.ArrayUtils;
 import com.android.internal.util.XmlUtils;
 
 import libcore.io.IoUtils;
 
 import org.xmlpull.v1.XmlPullParser;
 import org.xmlpull.v1.XmlPullParserException;
-import org.xmlpull.v1.XmlSerializer;
 
 import java.io.File;
+import java.io.FileDescriptor;
+import java.io.FileInputStream;
 import java.io.FileNotFoundException;
 import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.InputStream;
+import java.io.PrintWriter;
 import java.nio.charset.StandardCharsets;
 import java.util.ArrayList;
 import java.util.List;
-import java.util.Map;
-import java.util.concurrent.ExecutorService;
-import java.util.concurrent.Executors;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.Future;
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.concurrent.ThreadPoolExecutor;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
 
 /**
  * Notification assistant that provides guidance on notification channel blocking
@@ -78,9 +90,49 @@ public class Assistant extends NotificationAssistantService {
     private static final String TAG_ASSISTANT = "assistant";
     private static final String TAG_IMPRESSION = "impression-set";
     private static final String ATT_KEY = "key";
-    private static final int DB_VERSION = 1;
-    private static final String ATTR_VERSION = "version";
-    private final ExecutorService mSingleThreadExecutor = Executors.newSingleThreadExecutor();
+
+    private static final String IMPRESSIONS_DIR = "assistant";
+    private static final String IMPRESSIONS_FILE = "blocking_helper_stats.bin";
+    private static final String LEGACY_IMPRESSIONS_FILE = "blocking_helper_stats.xml";
+    private static final String IMPRESSIONS_JOURNAL_FILE = "blocking_helper_stats.journal";
+    @VisibleForTesting
+    static final long JOURNAL_COMPACTION_BYTES = 64 * 1024;
+    private static final int MAX_ADJUSTMENT_BATCH_SIZE = 32;
+
+    // Smart suggestions run on a small pool, in order for each notification key. Suggestions
+    // that waited longer than this are dropped; the notification has likely been shown or updated
+    // by then.
+    private static final int WORK_QUEUE_THREADS = 2;
+    private static final int WORK_QUEUE_CAPACITY = 256;
+    private static final long SUGGEST_MAX_WAIT_MS = 5_000;
+    private final KeyedWorkQueue mWorkQueue = new KeyedWorkQueue(
+            TAG + ".work", WORK_QUEUE_THREADS, WORK_QUEUE_CAPACITY, SUGGEST_MAX_WAIT_MS);
+    // Suggestion events are logged on their own thread, so that they never wait for a slow
+    // suggestion. They refer to suggestions that were already delivered, so they need not be
+    // ordered after the suggestion work.
+    private final KeyedWorkQueue mEventQueue = new KeyedWorkQueue(
+            TAG + ".events", 1, WORK_QUEUE_CAPACITY, SUGGEST_MAX_WAIT_MS);
+    // How long destroying the service waits for the events still queued to be logged.
+    private static final long EVENT_DRAIN_TIMEOUT_MS = 500;
+    // Events that were not logged because the event queue was full or shut down.
+    private final AtomicLong mDroppedEvents = new AtomicLong();
+    // Entries built for enqueued notifications, waiting to be reused when they are posted.
+    private static final int ENTRY_CACHE_CAPACITY = 32;
+    private final NotificationEntryCache mEntryCache =
+            new NotificationEntryCache(ENTRY_CACHE_CAPACITY);
+    // Active notifications are replayed on connect in chunks, on a pool whose threads go away
+    // once the replay is done.
+    private static final int REPLAY_THREADS = 4;
+    private static final int REPLAY_CHUNK_SIZE = 16;
+    private static final long REPLAY_KEEP_ALIVE_S = 10;
+    private final ThreadPoolExecutor mReplayExecutor = createReplayExecutor();
+    // Written on the main thread; volatile because dump reads them on a binder thread.
+    private volatile int mLastReplayCount = -1;
+    private volatile long mLastReplayLatencyMs = -1;
+    // Suggestions computed for a notification that was updated in the meantime, and not posted.
+    private final AtomicLong mDiscardedSuggestions = new AtomicLong();
+    // How long each stage from enqueue to adjustment takes.
+    private final LatencyHistograms mLatencies = new LatencyHistograms();
 
     private static final ArrayList<Integer> PREJUDICAL_DISMISSALS = new ArrayList<>();
     static {
@@ -91,15 +143,43 @@ public class Assistant extends NotificationAssistantService {
     private SmartActionsHelper mSmartActionsHelper;
     private NotificationCategorizer mNotificationCategorizer;
 
-    // key : impressions tracker
-    // TODO: prune deleted channels and apps
-    private final ArrayMap<String, ChannelImpressions> mkeyToImpressions = new ArrayMap<>();
-    // SBN key : entry
-    protected ArrayMap<String, NotificationEntry> mLiveNotifications = new ArrayMap<>();
+    // channel : impressions tracker, for channels touched since the snapshot was mapped
+    private final ChannelImpressionsTable mkeyToImpressions = new ChannelImpressionsTable();
+    // Read-only view of the last committed snapshot; guarded by mkeyToImpressions.
+    private ImpressionsSnapshot.Mapped mSnapshot = null;
+    // Entries of the notifications that are showing; capped once settings are read.
+    @VisibleForTesting
+    final LiveNotifications mLiveNotifications =
+            new LiveNotifications(AssistantSettings.DEFAULT_LIVE_NOTIFICATIONS_MAX_BYTES);
 
     private Ranking mFakeRanking = null;
     private AtomicFile mFile = null;
+    private AtomicFile mLegacyFile = null;
+    // Impressions are loaded and written on this thread, in order.
+    private HandlerThread mPersistThread;
+    private Handler mPersistHandler;
+    private WriteBehindScheduler mImpressionsWriter;
+    private ImpressionsCollector mImpressionsCollector;
+    // Adjustments for posted notifications are sent to the system in batches, on the main
+    // thread. Suggestions for enqueued notifications are sent right away.
+    private Batcher<Adjustment> mAdjustmentBatcher;
+    // The following are only accessed on the persist thread.
+    private ImpressionsJournal mJournal = null;
+    private int mSnapshotGeneration = 0;
+    private boolean mCompactionPending = false;
+    // Changes not yet appended to the journal; guarded by mkeyToImpressions.
+    private ArrayList<ImpressionsJournal.Delta> mPendingDeltas = new ArrayList<>();
+
+    // Impressions events received while loading are buffered, since applying them to the
+    // partially loaded map would let the load overwrite or double count them. Guarded by
+    // mkeyToImpressions.
+    private boolean mImpressionsLoading = false;
+    private final ArrayList<Runnable> mPendingImpressionEvents = new ArrayList<>();
+    private long mImpressionsLoadStartMs;
+    private long mImpressionsTimeToReadyMs = -1;
+    private boolean mImpressionsLoadRequested = false;
     private IPackageManager mPackageManager;
+    private TargetSdkCache mTargetSdkCache;
 
     @VisibleForTesting
     protected AssistantSettings.Factory mSettingsFactory = AssistantSettings.FACTORY;
@@ -116,9 +196,25 @@ public class Assistant extends NotificationAssistantService {
         // Contexts are correctly hooked up by the creation step, which is required for the observer
         // to be hooked up/initialized.
         mPackageManager = ActivityThread.getPackageManager();
+        mTargetSdkCache = new TargetSdkCache(mPackageManager);
         mSettings = mSettingsFactory.createAndRegister(mHandler,
-                getApplicationContext().getContentResolver(), getUserId(), this::updateThresholds);
-        mSmartActionsHelper = new SmartActionsHelper(getContext(), mSettings);
+                getApplicationContext().getContentResolver(), getUserId(),
+                this::onSettingsChanged);
+        mPersistThread = new HandlerThread(TAG + ".persist", Process.THREAD_PRIORITY_BACKGROUND);
+        mPersistThread.start();
+        mPersistHandler = new Handler(mPersistThread.getLooper());
+        mImpressionsWriter = new WriteBehindScheduler(
+                mPersistHandler, this::persistImpressions, mSettings.mImpressionsWriteDelayMs);
+        mImpressionsCollector = new ImpressionsCollector(mPersistHandler, mkeyToImpressions,
+                mSettings.mImpressionsMaxAgeMs, this::onImpressionsCollected);
+        mAdjustmentBatcher = new Batcher<>(mHandler, this::deliverAdjustments,
+                MAX_ADJUSTMENT_BATCH_SIZE, mSettings.mAdjustmentBatchDeadlineMs);
+        final IntentFilter packageFilter = new IntentFilter(Intent.ACTION_PACKAGE_REMOVED);
+        packageFilter.addAction(Intent.ACTION_PACKAGE_ADDED);
+        packageFilter.addDataScheme("package");
+        registerReceiver(mPackageReceiver, packageFilter, null, mPersistHandler);
+        mSmartActionsHelper = new SmartActionsHelper(getContext(), mSettings, mLatencies,
+                mLiveNotifications::size);
         mNotificationCategorizer = new NotificationCategorizer();
         mSmsHelper = new SmsHelper(this);
         mSmsHelper.initialize();
@@ -131,32 +227,354 @@ public class Assistant extends NotificationAssistantService {
         if (mSmsHelper != null) {
             mSmsHelper.destroy();
         }
+        mWorkQueue.shutdown();
+        // The events still queued are logged before the service goes away.
+        if (!mEventQueue.drainAndShutdown(EVENT_DRAIN_TIMEOUT_MS)) {
+            Log.w(TAG, "Timed out logging the events still queued");
+        }
+        if (mSmartActionsHelper != null) {
+            mSmartActionsHelper.destroy();
+        }
+        mReplayExecutor.shutdown();
+        if (mAdjustmentBatcher != null) {
+            mAdjustmentBatcher.flush();
+        }
+        flushImpressions();
+        if (mPersistThread != null) {
+            unregisterReceiver(mPackageReceiver);
+            mPersistThread.quitSafely();
+        }
         super.onDestroy();
     }
 
+    @Override
+    protected void dump(FileDescriptor fd, PrintWriter pw, String[] args) {
+        if (ArrayUtils.contains(args, "--proto")) {
+            final ProtoOutputStream proto = new ProtoOutputStream(fd);
+            dumpProto(proto);
+            proto.flush();
+            return;
+        }
+        final String prefix = "  ";
+        pw.println(TAG + ":");
+        mLiveNotifications.dump(pw, prefix);
+        pw.println(prefix + "work queue: " + mWorkQueue
+                + ", discardedSuggestions=" + mDiscardedSuggestions.get()
+                + ", timedOutSuggestions=" + (mSmartActionsHelper == null
+                        ? 0 : mSmartActionsHelper.getSuggestTimeoutCount()));
+        pw.println(prefix + "event queue: " + mEventQueue
+                + ", droppedEvents=" + mDroppedEvents.get());
+        synchronized (mkeyToImpressions) {
+            pw.println(prefix + "impressions: channels=" + mkeyToImpressions.size()
+                    + ", tableBytes=" + mkeyToImpressions.estimateBytes()
+                    + ", snapshotRecords=" + (mSnapshot == null ? 0 : mSnapshot.size())
+                    + ", snapshotBytes=" + (mSnapshot == null ? 0 : mSnapshot.getBytes())
+                    + ", timeToReadyMs=" + mImpressionsTimeToReadyMs);
+        }
+        if (mImpressionsCollector != null) {
+            pw.println(prefix + "collector: sweeps=" + mImpressionsCollector.getSweepCount()
+                    + ", reclaimedEntries=" + mImpressionsCollector.getReclaimedEntries()
+                    + ", reclaimedBytes=" + mImpressionsCollector.getReclaimedBytes()
+                    + ", droppedRecords=" + mImpressionsCollector.getDroppedRecords());
+        }
+        if (mImpressionsWriter != null) {
+            pw.println(prefix + "writes: requested="
+                    + mImpressionsWriter.getRequestedWriteCount()
+                    + ", coalesced=" + mImpressionsWriter.getCoalescedWriteCount()
+                    + ", executed=" + mImpressionsWriter.getExecutedWriteCount()
+                    + ", totalUs=" + mImpressionsWriter.getTotalWriteUs()
+                    + ", longestUs=" + mImpressionsWriter.getLongestWriteUs());
+        }
+        pw.println(prefix + "caches (hits/misses):");
+        if (mSmartActionsHelper != null) {
+            final SessionStore sessions = mSmartActionsHelper.getSessions();
+            pw.println(prefix + "  session: " + sessions.getHitCount() + "/"
+                    + sessions.getMissCount() + ", size=" + sessions.size()
+                    + ", evictions=" + sessions.getEvictionCount());
+            final ConversationActionsCache results = mSmartActionsHelper.getResultCache();
+            pw.println(prefix + "  conversationActions: " + results.getHitCount() + "/"
+                    + results.getMissCount() + ", savedMs=" + results.getSavedMs());
+            final MessageWindowCache windows = mSmartActionsHelper.getMessageWindows();
+            pw.println(prefix + "  messages (reused/converted): " + windows.getReusedCount() + "/"
+                    + windows.getConvertedCount() + ", windows=" + windows.size());
+        }
+        pw.println(prefix + "  entry: " + mEntryCache.getHitCount() + "/"
+                + mEntryCache.getMissCount() + ", evictions=" + mEntryCache.getEvictionCount());
+        if (mTargetSdkCache != null) {
+            pw.println(prefix + "  targetSdk: " + mTargetSdkCache.getHitCount() + "/"
+                    + mTargetSdkCache.getMissCount());
+        }
+        if (mAdjustmentBatcher != null) {
+            pw.println(prefix + "adjustments: " + mAdjustmentBatcher.getItemCount()
+                    + " in " + mAdjustmentBatcher.getBatchCount() + " batches, largest="
+                    + mAdjustmentBatcher.getLargestBatch());
+        }
+        pw.println(prefix + "replay: count=" + mLastReplayCount
+                + ", latencyMs=" + mLastReplayLatencyMs);
+        mLatencies.dump(pw, prefix);
+        if (mSettings != null) {
+            mSettings.dump(pw, prefix);
+        }
+    }
+
+    private static void writeWorkQueueToProto(ProtoOutputStream proto, KeyedWorkQueue queue) {
+        proto.write(AssistantDumpProto.WorkQueue.DEPTH, queue.getDepth());
+        proto.write(AssistantDumpProto.WorkQueue.MAX_DEPTH, queue.getMaxDepth());
+        proto.write(AssistantDumpProto.WorkQueue.SUBMITTED, queue.getSubmittedCount());
+        proto.write(AssistantDumpProto.WorkQueue.EXECUTED, queue.getExecutedCount());
+        proto.write(AssistantDumpProto.WorkQueue.REJECTED, queue.getRejectedCount());
+        proto.write(AssistantDumpProto.WorkQueue.DROPPED_STALE, queue.getDroppedStaleCount());
+        proto.write(AssistantDumpProto.WorkQueue.SUPERSEDED, queue.getSupersededCount());
+        proto.write(AssistantDumpProto.WorkQueue.CANCELLED, queue.getCancelledCount());
+        proto.write(AssistantDumpProto.WorkQueue.AVERAGE_WAIT_MS, queue.getAverageWaitMs());
+        proto.write(AssistantDumpProto.WorkQueue.LONGEST_WAIT_MS, queue.getLongestWaitMs());
+    }
+
+    /** Writes the same report as {@link #dump} as an {@link AssistantDumpProto}. */
+    @VisibleForTesting
+    void dumpProto(ProtoOutputStream proto) {
+        long token = proto.start(AssistantDumpProto.LIVE_NOTIFICATIONS);
+        proto.write(AssistantDumpProto.LiveNotifications.COUNT, mLiveNotifications.size());
+        proto.write(AssistantDumpProto.LiveNotifications.BYTES, mLiveNotifications.getBytes());
+        proto.write(AssistantDumpProto.LiveNotifications.MAX_BYTES,
+                mLiveNotifications.getMaxBytes());
+        proto.write(AssistantDumpProto.LiveNotifications.PEAK_BYTES,
+                mLiveNotifications.getPeakBytes());
+        proto.write(AssistantDumpProto.LiveNotifications.EVICTIONS,
+                mLiveNotifications.getEvictionCount());
+        proto.end(token);
+
+        token = proto.start(AssistantDumpProto.WORK_QUEUE);
+        writeWorkQueueToProto(proto, mWorkQueue);
+        proto.write(AssistantDumpProto.WorkQueue.DISCARDED_SUGGESTIONS,
+                mDiscardedSuggestions.get());
+        if (mSmartActionsHelper != null) {
+            proto.write(AssistantDumpProto.WorkQueue.TIMED_OUT_SUGGESTIONS,
+                    mSmartActionsHelper.getSuggestTimeoutCount());
+        }
+        proto.end(token);
+
+        token = proto.start(AssistantDumpProto.EVENT_QUEUE);
+        writeWorkQueueToProto(proto, mEventQueue);
+        proto.write(AssistantDumpProto.WorkQueue.DROPPED_EVENTS, mDroppedEvents.get());
+        proto.end(token);
+
+        token = proto.start(AssistantDumpProto.IMPRESSIONS);
+        synchronized (mkeyToImpressions) {
+            proto.write(AssistantDumpProto.Impressions.CHANNELS, mkeyToImpressions.size());
+            proto.write(AssistantDumpProto.Impressions.TABLE_BYTES,
+                    mkeyToImpressions.estimateBytes());
+            if (mSnapshot != null) {
+                proto.write(AssistantDumpProto.Impressions.SNAPSHOT_RECORDS, mSnapshot.size());
+                proto.write(AssistantDumpProto.Impressions.SNAPSHOT_BYTES, mSnapshot.getBytes());
+            }
+            proto.write(AssistantDumpProto.Impressions.TIME_TO_READY_MS,
+                    mImpressionsTimeToReadyMs);
+        }
+        if (mImpressionsCollector != null) {
+            proto.write(AssistantDumpProto.Impressions.SWEEPS,
+                    mImpressionsCollector.getSweepCount());
+            proto.write(AssistantDumpProto.Impressions.RECLAIMED_ENTRIES,
+                    mImpressionsCollector.getReclaimedEntries());
+            proto.write(AssistantDumpProto.Impressions.RECLAIMED_BYTES,
+                    mImpressionsCollector.getReclaimedBytes());
+            proto.write(AssistantDumpProto.Impressions.DROPPED_RECORDS,
+                    mImpressionsCollector.getDroppedRecords());
+        }
+        proto.end(token);
+
+        if (mImpressionsWriter != null) {
+            token = proto.start(AssistantDumpProto.PERSISTENCE);
+            proto.write(AssistantDumpProto.Persistence.REQUESTED_WRITES,
+                    mImpressionsWriter.getRequestedWriteCount());
+            proto.write(AssistantDumpProto.Persistence.COALESCED_WRITES,
+                    mImpressionsWriter.getCoalescedWriteCount());
+            proto.write(AssistantDumpProto.Persistence.EXECUTED_WRITES,
+                    mImpressionsWriter.getExecutedWriteCount());
+            proto.write(AssistantDumpProto.Persistence.TOTAL_WRITE_US,
+                    mImpressionsWriter.getTotalWriteUs());
+            proto.write(AssistantDumpProto.Persistence.LONGEST_WRITE_US,
+                    mImpressionsWriter.getLongestWriteUs());
+            proto.end(token);
+        }
+
+        token = proto.start(AssistantDumpProto.CACHES);
+        if (mSmartActionsHelper != null) {
+            final SessionStore sessions = mSmartActionsHelper.getSessions();
+            proto.write(AssistantDumpProto.Caches.SESSION_HITS, sessions.getHitCount());
+            proto.write(AssistantDumpProto.Caches.SESSION_MISSES, sessions.getMissCount());
+            proto.write(AssistantDumpProto.Caches.SESSION_EVICTIONS,
+                    sessions.getEvictionCount());
+            proto.write(AssistantDumpProto.Caches.SESSIONS, sessions.size());
+            final ConversationActionsCache results = mSmartActionsHelper.getResultCache();
+            proto.write(AssistantDumpProto.Caches.CONVERSATION_ACTIONS_HITS,
+                    results.getHitCount());
+            proto.write(AssistantDumpProto.Caches.CONVERSATION_ACTIONS_MISSES,
+                    results.getMissCount());
+            proto.write(AssistantDumpProto.Caches.CONVERSATION_ACTIONS_SAVED_MS,
+                    results.getSavedMs());
+            final MessageWindowCache windows = mSmartActionsHelper.getMessageWindows();
+            proto.write(AssistantDumpProto.Caches.MESSAGES_REUSED, windows.getReusedCount());
+            proto.write(AssistantDumpProto.Caches.MESSAGES_CONVERTED,
+                    windows.getConvertedCount());
+        }
+        proto.write(AssistantDumpProto.Caches.ENTRY_HITS, mEntryCache.getHitCount());
+        proto.write(AssistantDumpProto.Caches.ENTRY_MISSES, mEntryCache.getMissCount());
+        proto.write(AssistantDumpProto.Caches.ENTRY_EVICTIONS, mEntryCache.getEvictionCount());
+        if (mTargetSdkCache != null) {
+            proto.write(AssistantDumpProto.Caches.TARGET_SDK_HITS, mTargetSdkCache.getHitCount());
+            proto.write(AssistantDumpProto.Caches.TARGET_SDK_MISSES,
+                    mTargetSdkCache.getMissCount());
+        }
+        proto.end(token);
+
+        if (mAdjustmentBatcher != null) {
+            token = proto.start(AssistantDumpProto.ADJUSTMENTS);
+            proto.write(AssistantDumpProto.Adjustments.ADJUSTMENTS,
+                    mAdjustmentBatcher.getItemCount());
+            proto.write(AssistantDumpProto.Adjustments.BATCHES, mAdjustmentBatcher.getBatchCount());
+            proto.write(AssistantDumpProto.Adjustments.LARGEST_BATCH,
+                    mAdjustmentBatcher.getLargestBatch());
+            proto.end(token);
+        }
+
+        token = proto.start(AssistantDumpProto.REPLAY);
+        proto.write(AssistantDumpProto.Replay.COUNT, mLastReplayCount);
+        proto.write(AssistantDumpProto.Replay.LATENCY_MS, mLastReplayLatencyMs);
+        proto.end(token);
+
+        mLatencies.writeToProto(proto, AssistantDumpProto.LATENCIES);
+
+        if (mSettings != null) {
+            mSettings.writeToProto(proto, AssistantDumpProto.SETTINGS);
+        }
+    }
+
     private void loadFile() {
         if (DEBUG) Slog.d(TAG, "loadFile");
-        AsyncTask.execute(() -> {
-            InputStream infile = null;
-            try {
-                infile = mFile.openRead();
-                readXml(infile);
-            } catch (FileNotFoundException e) {
-                Log.d(TAG, "File doesn't exist or isn't readable yet");
-            } catch (IOException e) {
-                Log.e(TAG, "Unable to read channel impressions", e);
-            } catch (NumberFormatException | XmlPullParserException e) {
-                Log.e(TAG, "Unable to parse channel impressions", e);
-            } finally {
-                IoUtils.closeQuietly(infile);
+        mPersistHandler.post(this::loadImpressions);
+    }
+
+    /** Maps the snapshot, replays its journal and opens the gate; runs on the persist thread. */
+    @VisibleForTesting
+    void loadImpressions() {
+        FileInputStream infile = null;
+        try {
+            infile = mFile.openRead();
+            if (!mapSnapshot(infile, true).hasLastUpdatedTimes()) {
+                // Keep the load time its records were given, so they age from it.
+                mCompactionPending = true;
+                saveFile();
             }
-        });
+        } catch (FileNotFoundException e) {
+            migrateLegacyFile();
+        } catch (IOException e) {
+            Log.e(TAG, "Unable to read channel impressions", e);
+        } finally {
+            IoUtils.closeQuietly(infile);
+        }
+        try {
+            replayJournal();
+        } finally {
+            finishImpressionsLoad();
+        }
+        // Drop whatever went stale while the service was not running.
+        mImpressionsCollector.schedule();
+    }
+
+    /**
+     * Imports impressions from the XML file used by older versions, then replaces it with the
+     * binary snapshot. The XML file is only deleted once the snapshot has been committed.
+     */
+    private void migrateLegacyFile() {
+        if (mLegacyFile == null) {
+            return;
+        }
+        InputStream infile = null;
+        try {
+            infile = mLegacyFile.openRead();
+            readXml(infile);
+        } catch (FileNotFoundException e) {
+            Log.d(TAG, "File doesn't exist or isn't readable yet");
+            return;
+        } catch (IOException e) {
+            Log.e(TAG, "Unable to read legacy channel impressions", e);
+            return;
+        } catch (NumberFormatException | XmlPullParserException e) {
+            Log.e(TAG, "Unable to parse legacy channel impressions", e);
+            return;
+        } finally {
+            IoUtils.closeQuietly(infile);
+        }
+        if (compactImpressions()) {
+            Slog.i(TAG, "Migrated channel impressions to binary format");
+            mLegacyFile.delete();
+        }
     }
 
+    private void replayJournal() {
+        if (mJournal == null) {
+            return;
+        }
+        try {
+            final int replayed = mJournal.replay(mSnapshotGeneration, (key, op) -> {
+                final String[] parts = ImpressionsSnapshot.splitKey(key);
+                if (parts == null) {
+                    return;
+                }
+                synchronized (mkeyToImpressions) {
+                    final int index = getOrCreateImpressionsLocked(
+                            parts[0], Integer.parseInt(parts[1]), parts[2]);
+                    applyDeltaLocked(index, op);
+                }
+            });
+            if (DEBUG) Slog.d(TAG, "Replayed " + replayed + " impression changes");
+        } catch (IOException e) {
+            Log.e(TAG, "Unable to replay channel impressions journal", e);
+            mCompactionPending = true;
+        }
+    }
+
+    /**
+     * Maps the snapshot behind {@code stream} so that channels are read from it as they are
+     * needed, instead of decoding every record into {@link #mkeyToImpressions}. Returns the new
+     * mapping.
+     *
+     * @param verify whether to check the whole file first; only needed for files this process
+     *               did not just write
+     */
+    private ImpressionsSnapshot.Mapped mapSnapshot(FileInputStream stream, boolean verify)
+            throws IOException {
+        final ImpressionsSnapshot.Mapped snapshot = ImpressionsSnapshot.Mapped.map(stream, verify);
+        synchronized (mkeyToImpressions) {
+            mSnapshot = snapshot;
+        }
+        mSnapshotGeneration = snapshot.getGeneration();
+        if (DEBUG) Slog.d(TAG, "Mapped " + snapshot.size() + " channel impressions");
+        return snapshot;
+    }
+
+    /** Replaces the mapped snapshot with the one just committed to {@link #mFile}. */
+    private void remapSnapshot() {
+        FileInputStream infile = null;
+        try {
+            infile = mFile.openRead();
+            mapSnapshot(infile, false);
+        } catch (IOException e) {
+            // The old mapping still holds the right values for every channel not yet promoted.
+            Slog.w(TAG, "Unable to map channel impressions", e);
+        } finally {
+            IoUtils.closeQuietly(infile);
+        }
+    }
+
+    /** Reads the legacy XML format; only used to migrate existing files. */
     protected void readXml(InputStream stream)
             throws XmlPullParserException, NumberFormatException, IOException {
         final XmlPullParser parser = Xml.newPullParser();
         parser.setInput(stream, StandardCharsets.UTF_8.name());
+        // The XML format has no last updated time; channels age from their migration.
+        final long nowMs = System.currentTimeMillis();
         final int outerDepth = parser.getDepth();
         while (XmlUtils.nextElementWithin(parser, outerDepth)) {
             if (!TAG_ASSISTANT.equals(parser.getName())) {
@@ -168,53 +586,175 @@ public class Assistant extends NotificationAssistantService {
                     continue;
                 }
                 String key = parser.getAttributeValue(null, ATT_KEY);
-                ChannelImpressions ci = createChannelImpressionsWithThresholds();
+                ChannelImpressions ci = new ChannelImpressions();
                 ci.populateFromXml(parser);
+                ci.setLastUpdatedMs(nowMs);
                 synchronized (mkeyToImpressions) {
-                    ci.append(mkeyToImpressions.get(key));
                     mkeyToImpressions.put(key, ci);
                 }
             }
         }
     }
 
+    /** Records a change to {@code key}'s impressions so that it is written out later. */
+    private void recordDeltaLocked(String key, int op) {
+        mPendingDeltas.add(new ImpressionsJournal.Delta(key, op));
+    }
+
+    private void applyDeltaLocked(int index, int op) {
+        switch (op) {
+            case ImpressionsJournal.OP_VIEW:
+                mkeyToImpressions.incrementViewsAt(index);
+                break;
+            case ImpressionsJournal.OP_DISMISSAL:
+                mkeyToImpressions.incrementDismissalsAt(index);
+                break;
+            case ImpressionsJournal.OP_RESET_STREAK:
+                mkeyToImpressions.resetStreakAt(index);
+                break;
+            default:
+                Slog.w(TAG, "Unknown impressions change " + op);
+        }
+    }
+
     private void saveFile() {
-        AsyncTask.execute(() -> {
-            final FileOutputStream stream;
+        mImpressionsWriter.markDirty();
+    }
+
+    /** Writes out any impressions changes that are still waiting for their write window. */
+    private void flushImpressions() {
+        if (mImpressionsWriter != null && mFile != null) {
+            mImpressionsWriter.flush();
+        }
+    }
+
+    /**
+     * Appends the changes recorded since the last write to the journal, folding the journal into
+     * a new snapshot once it grows past {@link #JOURNAL_COMPACTION_BYTES}. Without a journal the
+     * whole snapshot is rewritten.
+     */
+    private void persistImpressions() {
+        if (mFile == null) {
+            return;
+        }
+        if (mJournal == null || mCompactionPending) {
+            compactImpressions();
+            return;
+        }
+        final ArrayList<ImpressionsJournal.Delta> deltas;
+        synchronized (mkeyToImpressions) {
+            deltas = mPendingDeltas;
+            mPendingDeltas = new ArrayList<>();
+        }
+        try {
+            mJournal.append(deltas);
+        } catch (IOException e) {
+            Slog.w(TAG, "Failed to append to impressions journal, compacting", e);
+            compactImpressions();
+            return;
+        }
+        if (mJournal.length() > JOURNAL_COMPACTION_BYTES) {
+            compactImpressions();
+        }
+    }
+
+    /**
+     * Commits a snapshot of the current impressions under the next generation and starts a new,
+     * empty journal for it.
+     */
+    private boolean compactImpressions() {
+        final int generation = mSnapshotGeneration + 1;
+        if (!writeFile(generation)) {
+            mCompactionPending = true;
+            return false;
+        }
+        mSnapshotGeneration = generation;
+        mCompactionPending = false;
+        if (mSnapshot != null) {
+            remapSnapshot();
+        }
+        if (mJournal != null) {
             try {
-                stream = mFile.startWrite();
+                mJournal.reset(generation);
             } catch (IOException e) {
-                Slog.w(TAG, "Failed to save policy file", e);
-                return;
+                // A stale journal is ignored on the next load, so nothing is double counted.
+                Slog.w(TAG, "Failed to reset impressions journal", e);
+                mCompactionPending = true;
             }
-            try {
-                final XmlSerializer out = new FastXmlSerializer();
-                out.setOutput(stream, StandardCharsets.UTF_8.name());
-                writeXml(out);
-                mFile.finishWrite(stream);
-            } catch (IOException e) {
-                Slog.w(TAG, "Failed to save impressions file, restoring backup", e);
-                mFile.failWrite(stream);
+        }
+        return true;
+    }
+
+    private boolean writeFile(int generation) {
+        if (DEBUG) Slog.d(TAG, "writeFile " + generation);
+        final FileOutputStream stream;
+        try {
+            stream = mFile.startWrite();
+        } catch (IOException e) {
+            Slog.w(TAG, "Failed to save policy file", e);
+            return false;
+        }
+        try {
+            final List<ImpressionsCollector.Removal> removals;
+            final int dropped;
+            synchronized (mkeyToImpressions) {
+                // The snapshot includes every change made so far.
+                mPendingDeltas.clear();
+                removals = mImpressionsCollector.beginWriteLocked();
+                dropped = ImpressionsSnapshot.write(stream, mkeyToImpressions, generation,
+                        mSnapshot, mImpressionsCollector);
             }
-        });
+            mFile.finishWrite(stream);
+            mImpressionsCollector.onSnapshotCommitted(removals, dropped);
+            if (dropped > 0) {
+                Slog.i(TAG, "Dropped " + dropped + " stale channel impressions ("
+                        + dropped * ImpressionsSnapshot.RECORD_SIZE + " bytes) from snapshot");
+            }
+            return true;
+        } catch (IOException e) {
+            Slog.w(TAG, "Failed to save impressions file, restoring backup", e);
+            mFile.failWrite(stream);
+            return false;
+        }
     }
 
-    protected void writeXml(XmlSerializer out) throws IOException {
-        out.startDocument(null, true);
-        out.startTag(null, TAG_ASSISTANT);
-        out.attribute(null, ATTR_VERSION, Integer.toString(DB_VERSION));
-        synchronized (mkeyToImpressions) {
-            for (Map.Entry<String, ChannelImpressions> entry
-                    : mkeyToImpressions.entrySet()) {
-                // TODO: ensure channel still exists
-                out.startTag(null, TAG_IMPRESSION);
-                out.attribute(null, ATT_KEY, entry.getKey());
-                entry.getValue().writeXml(out);
-                out.endTag(null, TAG_IMPRESSION);
+    /** Called on the persist thread when impressions were collected, to rewrite the snapshot. */
+    private void onImpressionsCollected() {
+        mCompactionPending = true;
+        saveFile();
+        if (mImpressionsCollector.hasPendingRemovals()) {
+            // Removals are not journaled, so they are committed right away rather than lost if
+            // the service is killed before the write window ends.
+            flushImpressions();
+        }
+    }
+
+    private final BroadcastReceiver mPackageReceiver = new BroadcastReceiver() {
+        @Override
+        public void onReceive(Context context, Intent intent) {
+            final int uid = intent.getIntExtra(Intent.EXTRA_UID, -1);
+            if (intent.getData() == null || uid < 0) {
+                return;
             }
+            final String pkg = intent.getData().getSchemeSpecificPart();
+            final int userId = UserHandle.getUserId(uid);
+            // Installs and updates can change the target SDK.
+            mTargetSdkCache.invalidate(pkg, userId);
+            if (Intent.ACTION_PACKAGE_REMOVED.equals(intent.getAction())
+                    && !intent.getBooleanExtra(Intent.EXTRA_REPLACING, false)) {
+                mImpressionsCollector.onPackageRemoved(pkg, userId);
+            }
+        }
+    };
+
+    @Override
+    public void onNotificationChannelModified(String pkg, UserHandle user,
+            NotificationChannel channel, int modificationType) {
+        if (modificationType != NOTIFICATION_CHANNEL_OR_GROUP_DELETED
+                || user.getIdentifier() != UserHandle.myUserId()) {
+            return;
         }
-        out.endTag(null, TAG_ASSISTANT);
-        out.endDocument();
+        mImpressionsCollector.onChannelDeleted(pkg, user.getIdentifier(), channel.getId());
     }
 
     @Override
@@ -230,18 +770,37 @@ public class Assistant extends NotificationAssistantService {
         if (!isForCurrentUser(sbn)) {
             return null;
         }
-        mSingleThreadExecutor.submit(() -> {
+        // Only the latest version of a notification is worth classifying; a newer one replaces
+        // any suggestion work still waiting for the same key.
+        final String key = sbn.getKey();
+        final long enqueuedNanos = LatencyHistograms.start();
+        mWorkQueue.submit(key, KeyedWorkQueue.POLICY_LATEST, () -> {
+            mLatencies.recordSince(LatencyHistograms.STAGE_QUEUE_WAIT, enqueuedNanos);
+            final long buildStart = LatencyHistograms.start();
             NotificationEntry entry =
-                    new NotificationEntry(getContext(), mPackageManager, sbn, channel, mSmsHelper);
+                    new NotificationEntry(getContext(), mTargetSdkCache, sbn, channel, mSmsHelper);
+            mLatencies.recordSince(LatencyHistograms.STAGE_BUILD_ENTRY, buildStart);
+            // The notification is usually posted while its suggestions are being worked out.
+            mEntryCache.put(entry);
             SmartActionsHelper.SmartSuggestions suggestions = mSmartActionsHelper.suggest(entry);
+            if (mWorkQueue.hasPending(key, KeyedWorkQueue.POLICY_LATEST)) {
+                // Updated while this version was being classified.
+                mDiscardedSuggestions.incrementAndGet();
+                return;
+            }
             if (DEBUG) {
                 Log.d(TAG, String.format(
                         "Creating Adjustment for %s, with %d actions, and %d replies.",
-                        sbn.getKey(), suggestions.actions.size(), suggestions.replies.size()));
+                        key, suggestions.actions.size(), suggestions.replies.size()));
             }
             Adjustment adjustment = createEnqueuedNotificationAdjustment(
                     entry, suggestions.actions, suggestions.replies);
+            // Not batched: only adjustNotification reaches a notification that is still being
+            // enqueued, and the system waits for the assistant only briefly.
+            final long deliverStart = LatencyHistograms.start();
             adjustNotification(adjustment);
+            mLatencies.recordSince(LatencyHistograms.STAGE_DELIVER, deliverStart);
+            mLatencies.recordSince(LatencyHistograms.STAGE_TOTAL, enqueuedNanos);
         });
         return null;
     }
@@ -289,28 +848,139 @@ public class Assistant extends NotificationAssistantService {
             }
             Ranking ranking = getRanking(sbn.getKey(), rankingMap);
             if (ranking != null && ranking.getChannel() != null) {
-                NotificationEntry entry = new NotificationEntry(getContext(), mPackageManager,
-                        sbn, ranking.getChannel(), mSmsHelper);
-                String key = getKey(
-                        sbn.getPackageName(), sbn.getUserId(), ranking.getChannel().getId());
-                boolean shouldTriggerBlock;
-                synchronized (mkeyToImpressions) {
-                    ChannelImpressions ci = mkeyToImpressions.getOrDefault(key,
-                            createChannelImpressionsWithThresholds());
-                    mkeyToImpressions.put(key, ci);
-                    shouldTriggerBlock = ci.shouldTriggerBlock();
+                NotificationEntry entry = mEntryCache.take(sbn, ranking.getChannel());
+                if (entry == null) {
+                    entry = new NotificationEntry(getContext(), mTargetSdkCache, sbn,
+                            ranking.getChannel(), mSmsHelper);
                 }
-                if (ranking.getImportance() > IMPORTANCE_MIN && shouldTriggerBlock) {
-                    adjustNotification(createNegativeAdjustment(
-                            sbn.getPackageName(), sbn.getKey(), sbn.getUserId()));
-                }
-                mLiveNotifications.put(sbn.getKey(), entry);
+                onEntryPosted(sbn, entry, ranking);
             }
         } catch (Throwable e) {
             Log.e(TAG, "Error occurred processing post", e);
         }
     }
 
+    private void onEntryPosted(StatusBarNotification sbn, NotificationEntry entry,
+            Ranking ranking) {
+        final String channelId = ranking.getChannel().getId();
+        final int importance = ranking.getImportance();
+        runWhenImpressionsReady(() -> onImpressionsPosted(sbn, channelId, importance));
+        mLiveNotifications.put(entry);
+    }
+
+    /**
+     * Treats every active notification as newly posted, and records how long it took from
+     * connecting until they all were.
+     */
+    private void replayActiveNotifications() {
+        final long startMs = SystemClock.uptimeMillis();
+        final StatusBarNotification[] active = getActiveNotifications();
+        replayActiveNotifications(active, active == null ? null : getCurrentRanking());
+        mLastReplayLatencyMs = SystemClock.uptimeMillis() - startMs;
+        Slog.i(TAG, "Replayed " + mLastReplayCount + " active notifications in "
+                + mLastReplayLatencyMs + "ms");
+    }
+
+    /**
+     * Building the entries is the slow part, with an IPC and a copy of the notification each, so
+     * they are built in chunks on the replay pool. They are then applied on this thread in the
+     * order of the active notifications, which leaves the same state as posting them one by one.
+     */
+    @VisibleForTesting
+    void replayActiveNotifications(@Nullable StatusBarNotification[] active,
+            RankingMap rankingMap) {
+        final int count = active == null ? 0 : active.length;
+        mLastReplayCount = count;
+        if (count > 0) {
+            // Each package is looked up once first, rather than by several chunks at the same
+            // time.
+            if (!awaitAll(prewarmTargetSdks(active))) {
+                return;
+            }
+            final NotificationEntry[] entries = new NotificationEntry[count];
+            final Ranking[] rankings = new Ranking[count];
+            final ArrayList<Future<?>> chunks = new ArrayList<>();
+            for (int start = 0; start < count; start += REPLAY_CHUNK_SIZE) {
+                final int from = start;
+                final int to = Math.min(start + REPLAY_CHUNK_SIZE, count);
+                chunks.add(mReplayExecutor.submit(() -> {
+                    for (int i = from; i < to; i++) {
+                        createReplayEntry(active[i], rankingMap, entries, rankings, i);
+                    }
+                }));
+            }
+            if (!awaitAll(chunks)) {
+                return;
+            }
+            for (int i = 0; i < count; i++) {
+                if (entries[i] != null) {
+                    onEntryPosted(active[i], entries[i], rankings[i]);
+                }
+            }
+        }
+    }
+
+    private ArrayList<Future<?>> prewarmTargetSdks(StatusBarNotification[] active) {
+        final ArraySet<String> seen = new ArraySet<>();
+        final ArrayList<Future<?>> lookups = new ArrayList<>();
+        for (StatusBarNotification sbn : active) {
+            if (!isForCurrentUser(sbn) || !seen.add(sbn.getPackageName())) {
+                continue;
+            }
+            final String pkg = sbn.getPackageName();
+            final int userId = sbn.getUserId();
+            lookups.add(mReplayExecutor.submit(() -> mTargetSdkCache.getTargetSdk(pkg, userId)));
+        }
+        return lookups;
+    }
+
+    private static boolean awaitAll(List<Future<?>> futures) {
+        try {
+            for (Future<?> future : futures) {
+                future.get();
+            }
+            return true;
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+            Log.w(TAG, "Interrupted while replaying active notifications");
+        } catch (ExecutionException e) {
+            Log.e(TAG, "Error occurred replaying active notifications", e);
+        }
+        return false;
+    }
+
+    private void createReplayEntry(StatusBarNotification sbn, RankingMap rankingMap,
+            NotificationEntry[] entries, Ranking[] rankings, int index) {
+        try {
+            if (!isForCurrentUser(sbn)) {
+                return;
+            }
+            final Ranking ranking = getRanking(sbn.getKey(), rankingMap);
+            if (ranking != null && ranking.getChannel() != null) {
+                entries[index] = new NotificationEntry(getContext(), mTargetSdkCache, sbn,
+                        ranking.getChannel(), mSmsHelper);
+                rankings[index] = ranking;
+            }
+        } catch (Throwable e) {
+            Log.e(TAG, "Error occurred replaying " + sbn, e);
+        }
+    }
+
+    private void onImpressionsPosted(StatusBarNotification sbn, String channelId,
+            int importance) {
+        boolean shouldTriggerBlock;
+        synchronized (mkeyToImpressions) {
+            final int index = getOrCreateImpressionsLocked(
+                    sbn.getPackageName(), sbn.getUserId(), channelId);
+            mkeyToImpressions.setLastUpdatedMsAt(index, System.currentTimeMillis());
+            shouldTriggerBlock = mkeyToImpressions.shouldTriggerBlockAt(index);
+        }
+        if (importance > IMPORTANCE_MIN && shouldTriggerBlock) {
+            mAdjustmentBatcher.add(createNegativeAdjustment(
+                    sbn.getPackageName(), sbn.getKey(), sbn.getUserId()));
+        }
+    }
+
     @Override
     public void onNotificationRemoved(StatusBarNotification sbn, RankingMap rankingMap,
             NotificationStats stats, int reason) {
@@ -319,41 +989,125 @@ public class Assistant extends NotificationAssistantService {
                 return;
             }
 
-            boolean updatedImpressions = false;
-            String channelId = mLiveNotifications.remove(sbn.getKey()).getChannel().getId();
-            String key = getKey(sbn.getPackageName(), sbn.getUserId(), channelId);
-            synchronized (mkeyToImpressions) {
-                ChannelImpressions ci = mkeyToImpressions.getOrDefault(key,
-                        createChannelImpressionsWithThresholds());
-                if (stats != null && stats.hasSeen()) {
-                    ci.incrementViews();
-                    updatedImpressions = true;
+            mWorkQueue.cancel(sbn.getKey(), KeyedWorkQueue.POLICY_LATEST);
+            mEntryCache.remove(sbn.getKey());
+            final SessionStore.Session session =
+                    mSmartActionsHelper.onNotificationRemoved(sbn.getKey());
+            // After the events already queued for the notification, which need its session.
+            if (!mEventQueue.submit(sbn.getKey(), KeyedWorkQueue.POLICY_RUN,
+                    () -> mSmartActionsHelper.endSession(sbn.getKey(), session))) {
+                // Ending it is cheap; a full lane must not keep the session forever.
+                mSmartActionsHelper.endSession(sbn.getKey(), session);
+            }
+            final NotificationEntry entry = mLiveNotifications.remove(sbn.getKey());
+            final String channelId;
+            if (entry != null) {
+                channelId = entry.getChannel().getId();
+            } else {
+                // The entry was dropped to stay under the memory cap.
+                final NotificationChannel channel = getRanking(sbn.getKey(), rankingMap)
+                        .getChannel();
+                if (channel == null) {
+                    return;
                 }
-                if (PREJUDICAL_DISMISSALS.contains(reason)) {
-                    if ((!sbn.isAppGroup() || sbn.getNotification().isGroupChild())
-                            && !stats.hasInteracted()
-                            && stats.getDismissalSurface() != NotificationStats.DISMISSAL_AOD
-                            && stats.getDismissalSurface() != NotificationStats.DISMISSAL_PEEK
-                            && stats.getDismissalSurface() != NotificationStats.DISMISSAL_OTHER) {
-                        if (DEBUG) Log.i(TAG, "increment dismissals " + key);
-                        ci.incrementDismissals();
+                channelId = channel.getId();
+            }
+            runWhenImpressionsReady(() -> onImpressionsRemoved(sbn, channelId, stats, reason));
+        } catch (Throwable e) {
+            Slog.e(TAG, "Error occurred processing removal of " + sbn, e);
+        }
+    }
+
+    private void onImpressionsRemoved(StatusBarNotification sbn, String channelId,
+            NotificationStats stats, int reason) {
+        boolean updatedImpressions = false;
+        synchronized (mkeyToImpressions) {
+            final int index = getOrCreateImpressionsLocked(
+                    sbn.getPackageName(), sbn.getUserId(), channelId);
+            // Built once per channel, and only needed to journal changes.
+            final String key = mkeyToImpressions.keyAt(index);
+            mkeyToImpressions.setLastUpdatedMsAt(index, System.currentTimeMillis());
+            if (stats != null && stats.hasSeen()) {
+                mkeyToImpressions.incrementViewsAt(index);
+                recordDeltaLocked(key, ImpressionsJournal.OP_VIEW);
+                updatedImpressions = true;
+            }
+            if (PREJUDICAL_DISMISSALS.contains(reason)) {
+                if ((!sbn.isAppGroup() || sbn.getNotification().isGroupChild())
+                        && !stats.hasInteracted()
+                        && stats.getDismissalSurface() != NotificationStats.DISMISSAL_AOD
+                        && stats.getDismissalSurface() != NotificationStats.DISMISSAL_PEEK
+                        && stats.getDismissalSurface() != NotificationStats.DISMISSAL_OTHER) {
+                    if (DEBUG) Log.i(TAG, "increment dismissals " + key);
+                    mkeyToImpressions.incrementDismissalsAt(index);
+                    recordDeltaLocked(key, ImpressionsJournal.OP_DISMISSAL);
+                    updatedImpressions = true;
+                } else {
+                    if (DEBUG) Slog.i(TAG, "reset streak " + key);
+                    if (mkeyToImpressions.streakAt(index) > 0) {
+                        mkeyToImpressions.resetStreakAt(index);
+                        recordDeltaLocked(key, ImpressionsJournal.OP_RESET_STREAK);
                         updatedImpressions = true;
-                    } else {
-                        if (DEBUG) Slog.i(TAG, "reset streak " + key);
-                        if (ci.getStreak() > 0) {
-                            updatedImpressions = true;
-                        }
-                        ci.resetStreak();
                     }
                 }
-                mkeyToImpressions.put(key, ci);
             }
-            if (updatedImpressions) {
-                saveFile();
+        }
+        if (updatedImpressions) {
+            saveFile();
+        }
+    }
+
+    /**
+     * Runs {@code event} now if impressions are loaded. Otherwise it is queued and run, in order,
+     * once the load finishes, so events never touch the map before it holds the stored counts.
+     */
+    private void runWhenImpressionsReady(Runnable event) {
+        synchronized (mkeyToImpressions) {
+            if (mImpressionsLoading) {
+                mPendingImpressionEvents.add(event);
+                return;
             }
-        } catch (Throwable e) {
-            Slog.e(TAG, "Error occurred processing removal of " + sbn, e);
         }
+        event.run();
+    }
+
+    /** Marks impressions as loading; events are buffered until {@link #finishImpressionsLoad}. */
+    @VisibleForTesting
+    void startImpressionsLoad() {
+        synchronized (mkeyToImpressions) {
+            mImpressionsLoading = true;
+            mImpressionsLoadStartMs = SystemClock.elapsedRealtime();
+        }
+    }
+
+    /** Replays the events buffered while loading and opens the gate for new ones. */
+    @VisibleForTesting
+    void finishImpressionsLoad() {
+        int replayed = 0;
+        while (true) {
+            final ArrayList<Runnable> events;
+            synchronized (mkeyToImpressions) {
+                if (mPendingImpressionEvents.isEmpty()) {
+                    mImpressionsLoading = false;
+                    mImpressionsTimeToReadyMs =
+                            SystemClock.elapsedRealtime() - mImpressionsLoadStartMs;
+                    break;
+                }
+                // Events arriving while these run keep queueing behind them.
+                events = new ArrayList<>(mPendingImpressionEvents);
+                mPendingImpressionEvents.clear();
+            }
+            for (Runnable event : events) {
+                try {
+                    event.run();
+                } catch (Throwable e) {
+                    Log.e(TAG, "Error occurred replaying impressions event", e);
+                }
+            }
+            replayed += events.size();
+        }
+        Slog.i(TAG, "Channel impressions ready in " + mImpressionsTimeToReadyMs + "ms, replayed "
+                + replayed + " events");
     }
 
     @Override
@@ -376,7 +1130,7 @@ public class Assistant extends NotificationAssistantService {
         NotificationEntry entry = mLiveNotifications.get(key);
 
         if (entry != null) {
-            mSingleThreadExecutor.submit(
+            submitEvent(key,
                     () -> mSmartActionsHelper.onNotificationExpansionChanged(entry, isExpanded));
         }
     }
@@ -384,7 +1138,7 @@ public class Assistant extends NotificationAssistantService {
     @Override
     public void onNotificationDirectReplied(@NonNull String key) {
         if (DEBUG) Log.i(TAG, "onNotificationDirectReplied " + key);
-        mSingleThreadExecutor.submit(() -> mSmartActionsHelper.onNotificationDirectReplied(key));
+        submitEvent(key, () -> mSmartActionsHelper.onNotificationDirectReplied(key));
     }
 
     @Override
@@ -394,8 +1148,7 @@ public class Assistant extends NotificationAssistantService {
             Log.d(TAG, "onSuggestedReplySent() called with: key = [" + key + "], reply = [" + reply
                     + "], source = [" + source + "]");
         }
-        mSingleThreadExecutor.submit(
-                () -> mSmartActionsHelper.onSuggestedReplySent(key, reply, source));
+        submitEvent(key, () -> mSmartActionsHelper.onSuggestedReplySent(key, reply, source));
     }
 
     @Override
@@ -406,22 +1159,33 @@ public class Assistant extends NotificationAssistantService {
                     "onActionInvoked() called with: key = [" + key + "], action = [" + action.title
                             + "], source = [" + source + "]");
         }
-        mSingleThreadExecutor.submit(
-                () -> mSmartActionsHelper.onActionClicked(key, action, source));
+        submitEvent(key, () -> mSmartActionsHelper.onActionClicked(key, action, source));
+    }
+
+    private void submitEvent(String key, Runnable event) {
+        if (!mEventQueue.submit(key, KeyedWorkQueue.POLICY_RUN, event)) {
+            mDroppedEvents.incrementAndGet();
+        }
     }
 
     @Override
     public void onListenerConnected() {
         if (DEBUG) Log.i(TAG, "CONNECTED");
         try {
-            mFile = new AtomicFile(new File(new File(
-                    Environment.getDataUserCePackageDirectory(
-                            StorageManager.UUID_PRIVATE_INTERNAL, getUserId(), getPackageName()),
-                    "assistant"), "blocking_helper_stats.xml"));
-            loadFile();
-            for (StatusBarNotification sbn : getActiveNotifications()) {
-                onNotificationPosted(sbn);
+            // Impressions stay in memory across reconnects, and are flushed on disconnect, so
+            // they are only read from disk the first time.
+            if (!mImpressionsLoadRequested) {
+                mImpressionsLoadRequested = true;
+                final File dir = new File(Environment.getDataUserCePackageDirectory(
+                        StorageManager.UUID_PRIVATE_INTERNAL, getUserId(), getPackageName()),
+                        IMPRESSIONS_DIR);
+                mFile = new AtomicFile(new File(dir, IMPRESSIONS_FILE));
+                mLegacyFile = new AtomicFile(new File(dir, LEGACY_IMPRESSIONS_FILE));
+                mJournal = new ImpressionsJournal(new File(dir, IMPRESSIONS_JOURNAL_FILE));
+                startImpressionsLoad();
+                loadFile();
             }
+            replayActiveNotifications();
         } catch (Throwable e) {
             Log.e(TAG, "Error occurred on connection", e);
         }
@@ -429,14 +1193,17 @@ public class Assistant extends NotificationAssistantService {
 
     @Override
     public void onListenerDisconnected() {
+        if (DEBUG) Log.i(TAG, "DISCONNECTED");
+        flushImpressions();
     }
 
     private boolean isForCurrentUser(StatusBarNotification sbn) {
         return sbn != null && sbn.getUserId() == UserHandle.myUserId();
     }
 
+    @VisibleForTesting
     protected String getKey(String pkg, int userId, String channelId) {
-        return pkg + "|" + userId + "|" + channelId;
+        return ImpressionsSnapshot.joinKey(pkg, userId, channelId);
     }
 
     private Ranking getRanking(String key, RankingMap rankingMap) {
@@ -455,6 +1222,25 @@ public class Assistant extends NotificationAssistantService {
         return new Adjustment(packageName, key,  signals, "", user);
     }
 
+    private static ThreadPoolExecutor createReplayExecutor() {
+        final ThreadPoolExecutor executor = new ThreadPoolExecutor(REPLAY_THREADS, REPLAY_THREADS,
+                REPLAY_KEEP_ALIVE_S, TimeUnit.SECONDS, new LinkedBlockingQueue<>());
+        executor.allowCoreThreadTimeOut(true);
+        return executor;
+    }
+
+    /**
+     * Delivers a batch of adjustments for notifications that are already posted. These are not
+     * part of the enqueue path timed by {@link #mLatencies}; the batcher counts them instead.
+     */
+    private void deliverAdjustments(List<Adjustment> adjustments) {
+        if (adjustments.size() == 1) {
+            adjustNotification(adjustments.get(0));
+        } else {
+            adjustNotifications(adjustments);
+        }
+    }
+
     // for testing
 
     @VisibleForTesting
@@ -462,6 +1248,11 @@ public class Assistant extends NotificationAssistantService {
         mFile = file;
     }
 
+    @VisibleForTesting
+    void setJournal(ImpressionsJournal journal) {
+        mJournal = journal;
+    }
+
     @VisibleForTesting
     public void setFakeRanking(Ranking ranking) {
         mFakeRanking = ranking;
@@ -480,12 +1271,74 @@ public class Assistant extends NotificationAssistantService {
     @VisibleForTesting
     public void setPackageManager(IPackageManager pm) {
         mPackageManager = pm;
+        mTargetSdkCache = new TargetSdkCache(pm);
+    }
+
+    /** Time taken from connecting to impressions being loaded, or -1 if not loaded yet. */
+    long getImpressionsTimeToReadyMs() {
+        synchronized (mkeyToImpressions) {
+            return mImpressionsTimeToReadyMs;
+        }
+    }
+
+    @VisibleForTesting
+    WriteBehindScheduler getImpressionsWriter() {
+        return mImpressionsWriter;
+    }
+
+    @VisibleForTesting
+    ImpressionsCollector getImpressionsCollector() {
+        return mImpressionsCollector;
+    }
+
+    @VisibleForTesting
+    KeyedWorkQueue getWorkQueue() {
+        return mWorkQueue;
+    }
+
+    @VisibleForTesting
+    KeyedWorkQueue getEventQueue() {
+        return mEventQueue;
+    }
+
+    @VisibleForTesting
+    Batcher<Adjustment> getAdjustmentBatcher() {
+        return mAdjustmentBatcher;
+    }
+
+    /** Number of notifications replayed by the last connect, or -1 before the first one. */
+    @VisibleForTesting
+    int getLastReplayCount() {
+        return mLastReplayCount;
+    }
+
+    /** Time from connecting to having replayed every active notification, or -1. */
+    long getLastReplayLatencyMs() {
+        return mLastReplayLatencyMs;
+    }
+
+    @VisibleForTesting
+    NotificationEntryCache getEntryCache() {
+        return mEntryCache;
+    }
+
+    /** Suggestions that were computed but not posted because the notification was updated. */
+    long getDiscardedSuggestionCount() {
+        return mDiscardedSuggestions.get();
+    }
+
+    @VisibleForTesting
+    LatencyHistograms getLatencies() {
+        return mLatencies;
     }
 
     @VisibleForTesting
     public ChannelImpressions getImpressions(String key) {
+        final String[] parts = ImpressionsSnapshot.splitKey(key);
         synchronized (mkeyToImpressions) {
-            return mkeyToImpressions.get(key);
+            final int index =
+                    findImpressionsLocked(parts[0], Integer.parseInt(parts[1]), parts[2]);
+            return index < 0 ? null : mkeyToImpressions.getImpressionsAt(index);
         }
     }
 
@@ -496,19 +1349,66 @@ public class Assistant extends NotificationAssistantService {
         }
     }
 
-    private ChannelImpressions createChannelImpressionsWithThresholds() {
-        ChannelImpressions impressions = new ChannelImpressions();
-        impressions.updateThresholds(mSettings.mDismissToViewRatioLimit, mSettings.mStreakLimit);
-        return impressions;
+    @VisibleForTesting
+    void setMappedSnapshot(ImpressionsSnapshot.Mapped snapshot) {
+        synchronized (mkeyToImpressions) {
+            mSnapshot = snapshot;
+        }
+    }
+
+    /**
+     * Returns the position in {@link #mkeyToImpressions} of the given channel's impressions,
+     * promoting them from the mapped snapshot the first time they are touched, or -1 if there
+     * are none.
+     */
+    private int findImpressionsLocked(String pkg, int userId, String channelId) {
+        final int index = mkeyToImpressions.indexOf(pkg, userId, channelId);
+        if (index >= 0 || mSnapshot == null) {
+            return index;
+        }
+        final int record = mSnapshot.find(pkg, userId, channelId);
+        if (record < 0) {
+            return -1;
+        }
+        final long lastUpdatedMs = mSnapshot.getLastUpdatedMs(record);
+        if (mImpressionsCollector != null
+                && mImpressionsCollector.isStaleLocked(pkg, userId, channelId, lastUpdatedMs)) {
+            // Collected, but the snapshot has not been rewritten yet.
+            return -1;
+        }
+        return mkeyToImpressions.put(pkg, userId, channelId, mSnapshot.getDismissals(record),
+                mSnapshot.getViews(record), mSnapshot.getStreak(record), lastUpdatedMs);
+    }
+
+    private int getOrCreateImpressionsLocked(String pkg, int userId, String channelId) {
+        final int index = findImpressionsLocked(pkg, userId, channelId);
+        if (index >= 0) {
+            return index;
+        }
+        return mkeyToImpressions.put(
+                pkg, userId, channelId, 0, 0, 0, System.currentTimeMillis());
+    }
+
+    private void onSettingsChanged() {
+        updateThresholds();
+        // Settings are first read while being constructed, before the writer exists.
+        if (mImpressionsWriter != null) {
+            mImpressionsWriter.setWindowMs(mSettings.mImpressionsWriteDelayMs);
+        }
+        if (mImpressionsCollector != null) {
+            mImpressionsCollector.setMaxAgeMs(mSettings.mImpressionsMaxAgeMs);
+        }
+        if (mAdjustmentBatcher != null) {
+            mAdjustmentBatcher.setDeadlineMs(mSettings.mAdjustmentBatchDeadlineMs);
+        }
+        mLiveNotifications.setMaxBytes(mSettings.mLiveNotificationsMaxBytes);
     }
 
     private void updateThresholds() {
-        // Update all existing channel impression objects with any new limits/thresholds.
+        // The thresholds are shared by every channel.
         synchronized (mkeyToImpressions) {
-            for (ChannelImpressions channelImpressions: mkeyToImpressions.values()) {
-                channelImpressions.updateThresholds(
-                        mSettings.mDismissToViewRatioLimit, mSettings.mStreakLimit);
-            }
+            mkeyToImpressions.setThresholds(
+                    mSettings.mDismissToViewRatioLimit, mSettings.mStreakLimit);
         }
     }
 }
@@ -0,0 +1,168 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static android.util.proto.ProtoOutputStream.FIELD_COUNT_REPEATED;
+import static android.util.proto.ProtoOutputStream.FIELD_COUNT_SINGLE;
+import static android.util.proto.ProtoOutputStream.FIELD_TYPE_BOOL;
+import static android.util.proto.ProtoOutputStream.FIELD_TYPE_FLOAT;
+import static android.util.proto.ProtoOutputStream.FIELD_TYPE_INT32;
+import static android.util.proto.ProtoOutputStream.FIELD_TYPE_INT64;
+import static android.util.proto.ProtoOutputStream.FIELD_TYPE_MESSAGE;
+import static android.util.proto.ProtoOutputStream.FIELD_TYPE_STRING;
+
+import android.util.proto.ProtoOutputStream;
+
+/**
+ * Field ids of the proto that {@link Assistant} dumps when passed {@code --proto}.
+ *
+ * <p>Each nested class is a message, and each constant a field, named after the field in upper
+ * case, like the classes generated for stream protos. This module does not compile protos, so the
+ * ids are kept here by hand: a field may be added, but its number must never change or be reused,
+ * since host-side tools decode the dump by number.
+ */
+final class AssistantDumpProto {
+    static final long LIVE_NOTIFICATIONS = message(1);
+    static final long WORK_QUEUE = message(2);
+    static final long IMPRESSIONS = message(3);
+    static final long PERSISTENCE = message(4);
+    static final long CACHES = message(5);
+    static final long ADJUSTMENTS = message(6);
+    static final long REPLAY = message(7);
+    static final long LATENCIES = ProtoOutputStream.makeFieldId(
+            8, FIELD_COUNT_REPEATED | FIELD_TYPE_MESSAGE);
+    static final long SETTINGS = message(9);
+    static final long EVENT_QUEUE = message(10);
+    // 11 was the classifier event batches; not to be reused.
+
+    static final class LiveNotifications {
+        static final long COUNT = int32(1);
+        static final long BYTES = int64(2);
+        static final long MAX_BYTES = int64(3);
+        static final long PEAK_BYTES = int64(4);
+        static final long EVICTIONS = int64(5);
+    }
+
+    static final class WorkQueue {
+        static final long DEPTH = int32(1);
+        static final long MAX_DEPTH = int32(2);
+        static final long SUBMITTED = int64(3);
+        static final long EXECUTED = int64(4);
+        static final long REJECTED = int64(5);
+        static final long DROPPED_STALE = int64(6);
+        static final long SUPERSEDED = int64(7);
+        static final long CANCELLED = int64(8);
+        static final long AVERAGE_WAIT_MS = int64(9);
+        static final long LONGEST_WAIT_MS = int64(10);
+        static final long DISCARDED_SUGGESTIONS = int64(11);
+        static final long TIMED_OUT_SUGGESTIONS = int64(12);
+        static final long DROPPED_EVENTS = int64(13);
+    }
+
+    static final class Impressions {
+        static final long CHANNELS = int32(1);
+        static final long TABLE_BYTES = int64(2);
+        static final long SNAPSHOT_RECORDS = int32(3);
+        static final long SNAPSHOT_BYTES = int64(4);
+        static final long TIME_TO_READY_MS = int64(5);
+        static final long SWEEPS = int64(6);
+        static final long RECLAIMED_ENTRIES = int64(7);
+        static final long RECLAIMED_BYTES = int64(8);
+        static final long DROPPED_RECORDS = int64(9);
+    }
+
+    static final class Persistence {
+        static final long REQUESTED_WRITES = int64(1);
+        static final long COALESCED_WRITES = int64(2);
+        static final long EXECUTED_WRITES = int64(3);
+        static final long TOTAL_WRITE_US = int64(4);
+        static final long LONGEST_WRITE_US = int64(5);
+    }
+
+    static final class Caches {
+        static final long SESSION_HITS = int64(1);
+        static final long SESSION_MISSES = int64(2);
+        static final long ENTRY_HITS = int64(3);
+        static final long ENTRY_MISSES = int64(4);
+        static final long ENTRY_EVICTIONS = int64(5);
+        static final long TARGET_SDK_HITS = int64(6);
+        static final long TARGET_SDK_MISSES = int64(7);
+        static final long CONVERSATION_ACTIONS_HITS = int64(8);
+        static final long CONVERSATION_ACTIONS_MISSES = int64(9);
+        static final long CONVERSATION_ACTIONS_SAVED_MS = int64(10);
+        static final long MESSAGES_REUSED = int64(11);
+        static final long MESSAGES_CONVERTED = int64(12);
+        static final long SESSION_EVICTIONS = int64(13);
+        static final long SESSIONS = int32(14);
+    }
+
+    static final class Adjustments {
+        static final long ADJUSTMENTS = int64(1);
+        static final long BATCHES = int64(2);
+        static final long LARGEST_BATCH = int32(3);
+    }
+
+    static final class Replay {
+        static final long COUNT = int32(1);
+        static final long LATENCY_MS = int64(2);
+    }
+
+    static final class StageLatency {
+        static final long STAGE = ProtoOutputStream.makeFieldId(
+                1, FIELD_COUNT_SINGLE | FIELD_TYPE_STRING);
+        static final long COUNT = int64(2);
+        static final long P50_US = int64(3);
+        static final long P90_US = int64(4);
+        static final long P99_US = int64(5);
+    }
+
+    static final class Settings {
+        static final long DISMISS_TO_VIEW_RATIO_LIMIT = ProtoOutputStream.makeFieldId(
+                1, FIELD_COUNT_SINGLE | FIELD_TYPE_FLOAT);
+        static final long STREAK_LIMIT = int32(2);
+        static final long GENERATE_REPLIES = bool(3);
+        static final long GENERATE_ACTIONS = bool(4);
+        static final long NEW_INTERRUPTION_MODEL = bool(5);
+        static final long MAX_MESSAGES_TO_EXTRACT = int32(6);
+        static final long MAX_SUGGESTIONS = int32(7);
+        static final long IMPRESSIONS_WRITE_DELAY_MS = int64(8);
+        static final long IMPRESSIONS_MAX_AGE_MS = int64(9);
+        static final long ADJUSTMENT_BATCH_DEADLINE_MS = int64(10);
+        static final long LIVE_NOTIFICATIONS_MAX_BYTES = int64(11);
+        static final long SUGGEST_DEADLINE_MS = int64(12);
+        // 13 was the classifier event batch deadline; not to be reused.
+    }
+
+    private static long message(int id) {
+        return ProtoOutputStream.makeFieldId(id, FIELD_COUNT_SINGLE | FIELD_TYPE_MESSAGE);
+    }
+
+    private static long int32(int id) {
+        return ProtoOutputStream.makeFieldId(id, FIELD_COUNT_SINGLE | FIELD_TYPE_INT32);
+    }
+
+    private static long int64(int id) {
+        return ProtoOutputStream.makeFieldId(id, FIELD_COUNT_SINGLE | FIELD_TYPE_INT64);
+    }
+
+    private static long bool(int id) {
+        return ProtoOutputStream.makeFieldId(id, FIELD_COUNT_SINGLE | FIELD_TYPE_BOOL);
+    }
+
+    private AssistantDumpProto() {
+    }
+}
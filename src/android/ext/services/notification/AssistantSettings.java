@@ -23,10 +23,13 @@ import android.os.Handler;
 import android.provider.DeviceConfig;
 import android.provider.Settings;
 import android.util.Log;
+import android.util.proto.ProtoOutputStream;
 
 import com.android.internal.annotations.VisibleForTesting;
 import com.android.internal.config.sysui.SystemUiDeviceConfigFlags;
 
+import java.io.PrintWriter;
+
 /**
  * Observes the settings for {@link Assistant}.
  */
@@ -39,6 +42,28 @@ final class AssistantSettings extends ContentObserver {
     private static final int DEFAULT_MAX_MESSAGES_TO_EXTRACT = 5;
     @VisibleForTesting
     static final int DEFAULT_MAX_SUGGESTIONS = 3;
+    @VisibleForTesting
+    static final long DEFAULT_IMPRESSIONS_WRITE_DELAY_MS = 5000;
+    @VisibleForTesting
+    static final long DEFAULT_IMPRESSIONS_MAX_AGE_MS = 90L * 24 * 60 * 60 * 1000;
+    @VisibleForTesting
+    static final long DEFAULT_ADJUSTMENT_BATCH_DEADLINE_MS = 50;
+    @VisibleForTesting
+    static final long DEFAULT_LIVE_NOTIFICATIONS_MAX_BYTES = 4L * 1024 * 1024;
+    @VisibleForTesting
+    static final long DEFAULT_SUGGEST_DEADLINE_MS = 1000;
+
+    // Device config flags owned by this module rather than SystemUiDeviceConfigFlags.
+    @VisibleForTesting
+    static final String NAS_IMPRESSIONS_WRITE_DELAY_MS = "nas_impressions_write_delay_ms";
+    @VisibleForTesting
+    static final String NAS_IMPRESSIONS_MAX_AGE_MS = "nas_impressions_max_age_ms";
+    @VisibleForTesting
+    static final String NAS_ADJUSTMENT_BATCH_DEADLINE_MS = "nas_adjustment_batch_deadline_ms";
+    @VisibleForTesting
+    static final String NAS_LIVE_NOTIFICATIONS_MAX_BYTES = "nas_live_notifications_max_bytes";
+    @VisibleForTesting
+    static final String NAS_SUGGEST_DEADLINE_MS = "nas_suggest_deadline_ms";
 
     private static final Uri STREAK_LIMIT_URI =
             Settings.Global.getUriFor(Settings.Global.BLOCKING_HELPER_STREAK_LIMIT);
@@ -64,6 +89,12 @@ final class AssistantSettings extends ContentObserver {
     boolean mNewInterruptionModel;
     int mMaxMessagesToExtract = DEFAULT_MAX_MESSAGES_TO_EXTRACT;
     int mMaxSuggestions = DEFAULT_MAX_SUGGESTIONS;
+    long mImpressionsWriteDelayMs = DEFAULT_IMPRESSIONS_WRITE_DELAY_MS;
+    long mImpressionsMaxAgeMs = DEFAULT_IMPRESSIONS_MAX_AGE_MS;
+    long mAdjustmentBatchDeadlineMs = DEFAULT_ADJUSTMENT_BATCH_DEADLINE_MS;
+    long mLiveNotificationsMaxBytes = DEFAULT_LIVE_NOTIFICATIONS_MAX_BYTES;
+    // Suggestions that take longer are given up on; 0 or less waits for them.
+    long mSuggestDeadlineMs = DEFAULT_SUGGEST_DEADLINE_MS;
 
     private AssistantSettings(Handler handler, ContentResolver resolver, int userId,
             Runnable onUpdateRunnable) {
@@ -140,6 +171,21 @@ final class AssistantSettings extends ContentObserver {
         mMaxSuggestions = DeviceConfig.getInt(DeviceConfig.NAMESPACE_SYSTEMUI,
                 SystemUiDeviceConfigFlags.NAS_MAX_SUGGESTIONS, DEFAULT_MAX_SUGGESTIONS);
 
+        mImpressionsWriteDelayMs = DeviceConfig.getLong(DeviceConfig.NAMESPACE_SYSTEMUI,
+                NAS_IMPRESSIONS_WRITE_DELAY_MS, DEFAULT_IMPRESSIONS_WRITE_DELAY_MS);
+
+        mImpressionsMaxAgeMs = DeviceConfig.getLong(DeviceConfig.NAMESPACE_SYSTEMUI,
+                NAS_IMPRESSIONS_MAX_AGE_MS, DEFAULT_IMPRESSIONS_MAX_AGE_MS);
+
+        mAdjustmentBatchDeadlineMs = DeviceConfig.getLong(DeviceConfig.NAMESPACE_SYSTEMUI,
+                NAS_ADJUSTMENT_BATCH_DEADLINE_MS, DEFAULT_ADJUSTMENT_BATCH_DEADLINE_MS);
+
+        mLiveNotificationsMaxBytes = DeviceConfig.getLong(DeviceConfig.NAMESPACE_SYSTEMUI,
+                NAS_LIVE_NOTIFICATIONS_MAX_BYTES, DEFAULT_LIVE_NOTIFICATIONS_MAX_BYTES);
+
+        mSuggestDeadlineMs = DeviceConfig.getLong(DeviceConfig.NAMESPACE_SYSTEMUI,
+                NAS_SUGGEST_DEADLINE_MS, DEFAULT_SUGGEST_DEADLINE_MS);
+
         mOnUpdateRunnable.run();
     }
 
@@ -169,6 +215,43 @@ final class AssistantSettings extends ContentObserver {
         mOnUpdateRunnable.run();
     }
 
+    void dump(PrintWriter pw, String prefix) {
+        pw.println(prefix + "settings:");
+        pw.println(prefix + "  dismissToViewRatioLimit=" + mDismissToViewRatioLimit);
+        pw.println(prefix + "  streakLimit=" + mStreakLimit);
+        pw.println(prefix + "  generateReplies=" + mGenerateReplies);
+        pw.println(prefix + "  generateActions=" + mGenerateActions);
+        pw.println(prefix + "  newInterruptionModel=" + mNewInterruptionModel);
+        pw.println(prefix + "  maxMessagesToExtract=" + mMaxMessagesToExtract);
+        pw.println(prefix + "  maxSuggestions=" + mMaxSuggestions);
+        pw.println(prefix + "  impressionsWriteDelayMs=" + mImpressionsWriteDelayMs);
+        pw.println(prefix + "  impressionsMaxAgeMs=" + mImpressionsMaxAgeMs);
+        pw.println(prefix + "  adjustmentBatchDeadlineMs=" + mAdjustmentBatchDeadlineMs);
+        pw.println(prefix + "  liveNotificationsMaxBytes=" + mLiveNotificationsMaxBytes);
+        pw.println(prefix + "  suggestDeadlineMs=" + mSuggestDeadlineMs);
+    }
+
+    void writeToProto(ProtoOutputStream proto, long fieldId) {
+        final long token = proto.start(fieldId);
+        proto.write(AssistantDumpProto.Settings.DISMISS_TO_VIEW_RATIO_LIMIT,
+                mDismissToViewRatioLimit);
+        proto.write(AssistantDumpProto.Settings.STREAK_LIMIT, mStreakLimit);
+        proto.write(AssistantDumpProto.Settings.GENERATE_REPLIES, mGenerateReplies);
+        proto.write(AssistantDumpProto.Settings.GENERATE_ACTIONS, mGenerateActions);
+        proto.write(AssistantDumpProto.Settings.NEW_INTERRUPTION_MODEL, mNewInterruptionModel);
+        proto.write(AssistantDumpProto.Settings.MAX_MESSAGES_TO_EXTRACT, mMaxMessagesToExtract);
+        proto.write(AssistantDumpProto.Settings.MAX_SUGGESTIONS, mMaxSuggestions);
+        proto.write(AssistantDumpProto.Settings.IMPRESSIONS_WRITE_DELAY_MS,
+                mImpressionsWriteDelayMs);
+        proto.write(AssistantDumpProto.Settings.IMPRESSIONS_MAX_AGE_MS, mImpressionsMaxAgeMs);
+        proto.write(AssistantDumpProto.Settings.ADJUSTMENT_BATCH_DEADLINE_MS,
+                mAdjustmentBatchDeadlineMs);
+        proto.write(AssistantDumpProto.Settings.LIVE_NOTIFICATIONS_MAX_BYTES,
+                mLiveNotificationsMaxBytes);
+        proto.write(AssistantDumpProto.Settings.SUGGEST_DEADLINE_MS, mSuggestDeadlineMs);
+        proto.end(token);
+    }
+
     public interface Factory {
         AssistantSettings createAndRegister(Handler handler, ContentResolver resolver, int userId,
                 Runnable onUpdateRunnable);
@@ -0,0 +1,155 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.os.Handler;
+import android.os.Looper;
+
+import com.android.internal.annotations.GuardedBy;
+
+import java.util.ArrayList;
+import java.util.Collections;
+import java.util.List;
+
+/**
+ * Gathers items into batches, so that a burst of them reaches the system in a few binder calls
+ * instead of one call each. Used for adjustments of posted notifications.
+ *
+ * <p>The first item of a batch starts the deadline; the batch is delivered on the handler's
+ * thread once the deadline has passed, or as soon as it is full. No item waits longer than the
+ * deadline, and batches are delivered in order. A deadline of 0 turns batching off: every item
+ * is then delivered on its own, on the caller's thread.
+ */
+final class Batcher<T> {
+    /** Delivers a batch of items. */
+    interface Sink<T> {
+        void deliver(@NonNull List<T> items);
+    }
+
+    private final Handler mHandler;
+    private final Sink<T> mSink;
+    private final int mMaxBatchSize;
+    private final Runnable mDeliverRunnable = this::deliverPending;
+
+    private final Object mLock = new Object();
+    @GuardedBy("mLock")
+    private long mDeadlineMs;
+    @GuardedBy("mLock")
+    private ArrayList<T> mPending = new ArrayList<>();
+    @GuardedBy("mLock")
+    private long mItems;
+    @GuardedBy("mLock")
+    private long mBatches;
+    @GuardedBy("mLock")
+    private int mLargestBatch;
+
+    /**
+     * @param handler the handler whose thread batches are delivered on
+     * @param maxBatchSize the most items delivered at once
+     * @param deadlineMs the longest an item may wait for its batch to be delivered
+     */
+    Batcher(@NonNull Handler handler, @NonNull Sink<T> sink, int maxBatchSize, long deadlineMs) {
+        mHandler = handler;
+        mSink = sink;
+        mMaxBatchSize = maxBatchSize;
+        mDeadlineMs = deadlineMs;
+    }
+
+    void setDeadlineMs(long deadlineMs) {
+        synchronized (mLock) {
+            mDeadlineMs = deadlineMs;
+        }
+    }
+
+    /** Queues {@code item} for the current batch, starting a new batch if needed. */
+    void add(@NonNull T item) {
+        synchronized (mLock) {
+            if (mDeadlineMs <= 0 && mPending.isEmpty()) {
+                recordBatchLocked(1);
+            } else {
+                mPending.add(item);
+                if (mPending.size() == 1) {
+                    mHandler.postDelayed(mDeliverRunnable, Math.max(mDeadlineMs, 0));
+                } else if (mPending.size() == mMaxBatchSize) {
+                    mHandler.removeCallbacks(mDeliverRunnable);
+                    mHandler.post(mDeliverRunnable);
+                }
+                return;
+            }
+        }
+        mSink.deliver(Collections.singletonList(item));
+    }
+
+    /**
+     * Delivers the current batch now and waits for it to be delivered. Safe to call from any
+     * thread, including the handler's.
+     */
+    void flush() {
+        mHandler.removeCallbacks(mDeliverRunnable);
+        if (Looper.myLooper() == mHandler.getLooper()) {
+            deliverPending();
+        } else {
+            mHandler.runWithScissors(mDeliverRunnable, 0);
+        }
+    }
+
+    /** Number of items delivered. */
+    long getItemCount() {
+        synchronized (mLock) {
+            return mItems;
+        }
+    }
+
+    /** Number of batches delivered, which is the number of binder calls made. */
+    long getBatchCount() {
+        synchronized (mLock) {
+            return mBatches;
+        }
+    }
+
+    int getLargestBatch() {
+        synchronized (mLock) {
+            return mLargestBatch;
+        }
+    }
+
+    @GuardedBy("mLock")
+    private void recordBatchLocked(int size) {
+        mItems += size;
+        mBatches++;
+        mLargestBatch = Math.max(mLargestBatch, size);
+    }
+
+    private void deliverPending() {
+        final ArrayList<T> pending;
+        synchronized (mLock) {
+            if (mPending.isEmpty()) {
+                return;
+            }
+            pending = mPending;
+            mPending = new ArrayList<>();
+            // Items added while a full batch waited to be delivered go out in the next.
+            for (int i = 0; i < pending.size(); i += mMaxBatchSize) {
+                recordBatchLocked(Math.min(mMaxBatchSize, pending.size() - i));
+            }
+        }
+        for (int i = 0; i < pending.size(); i += mMaxBatchSize) {
+            mSink.deliver(pending.subList(i, Math.min(i + mMaxBatchSize, pending.size())));
+        }
+    }
+}
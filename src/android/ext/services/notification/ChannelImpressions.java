@@ -43,6 +43,8 @@ public final class ChannelImpressions implements Parcelable {
     private int mDismissals = 0;
     private int mViews = 0;
     private int mStreak = 0;
+    // Wall clock time the channel was last posted to or had its counters changed; 0 if unknown.
+    private long mLastUpdatedMs = 0;
 
     private float mDismissToViewRatioLimit;
     private int mStreakLimit;
@@ -56,6 +58,7 @@ public final class ChannelImpressions implements Parcelable {
         mDismissals = in.readInt();
         mViews = in.readInt();
         mStreak = in.readInt();
+        mLastUpdatedMs = in.readLong();
         mDismissToViewRatioLimit = in.readFloat();
         mStreakLimit = in.readInt();
     }
@@ -72,6 +75,14 @@ public final class ChannelImpressions implements Parcelable {
         return mViews;
     }
 
+    long getLastUpdatedMs() {
+        return mLastUpdatedMs;
+    }
+
+    void setLastUpdatedMs(long lastUpdatedMs) {
+        mLastUpdatedMs = lastUpdatedMs;
+    }
+
     public void incrementDismissals() {
         mDismissals++;
         mStreak++;
@@ -100,6 +111,12 @@ public final class ChannelImpressions implements Parcelable {
         }
     }
 
+    void setCounts(int dismissals, int views, int streak) {
+        mDismissals = dismissals;
+        mViews = views;
+        mStreak = streak;
+    }
+
     public void incrementViews() {
         mViews++;
     }
@@ -124,6 +141,7 @@ public final class ChannelImpressions implements Parcelable {
         dest.writeInt(mDismissals);
         dest.writeInt(mViews);
         dest.writeInt(mStreak);
+        dest.writeLong(mLastUpdatedMs);
         dest.writeFloat(mDismissToViewRatioLimit);
         dest.writeInt(mStreakLimit);
     }
@@ -171,6 +189,7 @@ public final class ChannelImpressions implements Parcelable {
         sb.append("mDismissals=").append(mDismissals);
         sb.append(", mViews=").append(mViews);
         sb.append(", mStreak=").append(mStreak);
+        sb.append(", mLastUpdatedMs=").append(mLastUpdatedMs);
         sb.append(", thresholds=(").append(mDismissToViewRatioLimit);
         sb.append(",").append(mStreakLimit);
         sb.append(")}");
@@ -0,0 +1,332 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.util.Log;
+
+import java.util.Arrays;
+
+/**
+ * Channel impressions keyed by (package, user, channel id).
+ *
+ * <p>Lookups take the three parts of the key as they come from a notification, so finding a
+ * channel neither concatenates nor allocates. The parts are hashed into an open-addressing index
+ * with linear probing, which points into dense arrays holding the parts and the impressions.
+ * Entries are addressed by their position in the dense arrays, from 0 to {@link #size()} - 1;
+ * {@link #removeAt} moves the last entry into the freed position, so like {@code ArrayMap} a loop
+ * that removes entries must not advance past a removed one.
+ *
+ * <p>The counters are stored column by column in primitive arrays rather than as one
+ * {@link ChannelImpressions} object per channel, and the blocking helper thresholds are held once
+ * for the whole table. {@link ChannelImpressions} remains as a detached copy of one entry.
+ *
+ * <p>The joined {@code pkg|user|channel} form of each key, used by the journal and for
+ * debugging, is built at most once per entry.
+ *
+ * <p>Not thread safe.
+ */
+final class ChannelImpressionsTable {
+    private static final String TAG = "ExtAssistant.CI";
+    private static final boolean DEBUG = Log.isLoggable(TAG, Log.DEBUG);
+
+    private static final int INITIAL_CAPACITY = 16;
+
+    // Open-addressing index: entry position + 1, or 0 for an empty slot. Its length is a power
+    // of two, kept at least twice the number of entries.
+    private int[] mSlots = new int[INITIAL_CAPACITY * 2];
+    private int mSize;
+
+    private String[] mPackages = new String[INITIAL_CAPACITY];
+    private int[] mUserIds = new int[INITIAL_CAPACITY];
+    private String[] mChannelIds = new String[INITIAL_CAPACITY];
+    private int[] mHashes = new int[INITIAL_CAPACITY];
+    private String[] mKeys = new String[INITIAL_CAPACITY];
+    private int[] mDismissals = new int[INITIAL_CAPACITY];
+    private int[] mViews = new int[INITIAL_CAPACITY];
+    private int[] mStreaks = new int[INITIAL_CAPACITY];
+    // Wall clock time each channel was last posted to or had its counters changed; 0 if unknown.
+    private long[] mLastUpdatedMs = new long[INITIAL_CAPACITY];
+
+    private float mDismissToViewRatioLimit = ChannelImpressions.DEFAULT_DISMISS_TO_VIEW_RATIO_LIMIT;
+    private int mStreakLimit = ChannelImpressions.DEFAULT_STREAK_LIMIT;
+
+    int size() {
+        return mSize;
+    }
+
+    boolean isEmpty() {
+        return mSize == 0;
+    }
+
+    /**
+     * Estimates the memory held by the table's arrays, in bytes. Package names and channel ids
+     * are shared with the rest of the process, so they are left out.
+     */
+    long estimateBytes() {
+        final long perEntry = 4 * Long.BYTES  // package, channel id and key references
+                + 5 * Integer.BYTES  // user id, hash and counters
+                + Long.BYTES;  // last updated time
+        return (long) mSlots.length * Integer.BYTES + (long) mDismissals.length * perEntry;
+    }
+
+    /** Returns the position of the entry for the given channel, or -1 if there is none. */
+    int indexOf(@NonNull String pkg, int userId, @NonNull String channelId) {
+        final int hash = hash(pkg, userId, channelId);
+        final int mask = mSlots.length - 1;
+        for (int slot = hash & mask; ; slot = (slot + 1) & mask) {
+            final int index = mSlots[slot] - 1;
+            if (index < 0) {
+                return -1;
+            }
+            if (mHashes[index] == hash && mUserIds[index] == userId
+                    && mPackages[index].equals(pkg) && mChannelIds[index].equals(channelId)) {
+                return index;
+            }
+        }
+    }
+
+    /** Like {@link #indexOf(String, int, String)}, for a joined key. */
+    int indexOfKey(@NonNull String key) {
+        final String[] parts = ImpressionsSnapshot.splitKey(key);
+        if (parts == null) {
+            return -1;
+        }
+        return indexOf(parts[0], Integer.parseInt(parts[1]), parts[2]);
+    }
+
+    /** Sets the impressions for the given channel and returns the entry's position. */
+    int put(@NonNull String pkg, int userId, @NonNull String channelId, int dismissals,
+            int views, int streak, long lastUpdatedMs) {
+        int index = indexOf(pkg, userId, channelId);
+        if (index < 0) {
+            if (mSize == mDismissals.length) {
+                grow();
+            }
+            index = mSize++;
+            mPackages[index] = pkg;
+            mUserIds[index] = userId;
+            mChannelIds[index] = channelId;
+            mHashes[index] = hash(pkg, userId, channelId);
+            mKeys[index] = null;
+            mSlots[findEmptySlot(mHashes[index])] = index + 1;
+        }
+        mDismissals[index] = dismissals;
+        mViews[index] = views;
+        mStreaks[index] = streak;
+        mLastUpdatedMs[index] = lastUpdatedMs;
+        return index;
+    }
+
+    /** Sets the impressions for the given channel from {@code ci}. */
+    int put(@NonNull String pkg, int userId, @NonNull String channelId,
+            @NonNull ChannelImpressions ci) {
+        return put(pkg, userId, channelId, ci.getDismissals(), ci.getViews(), ci.getStreak(),
+                ci.getLastUpdatedMs());
+    }
+
+    /**
+     * Like {@link #put(String, int, String, ChannelImpressions)}, for a joined key.
+     *
+     * @return the entry's position, or -1 if {@code key} is malformed
+     */
+    int put(@NonNull String key, @NonNull ChannelImpressions ci) {
+        final String[] parts = ImpressionsSnapshot.splitKey(key);
+        if (parts == null) {
+            return -1;
+        }
+        final int index = put(parts[0], Integer.parseInt(parts[1]), parts[2], ci);
+        mKeys[index] = key;
+        return index;
+    }
+
+    String packageAt(int index) {
+        return mPackages[index];
+    }
+
+    int userIdAt(int index) {
+        return mUserIds[index];
+    }
+
+    String channelIdAt(int index) {
+        return mChannelIds[index];
+    }
+
+    /** Returns the joined {@code pkg|user|channel} key of the entry at {@code index}. */
+    String keyAt(int index) {
+        String key = mKeys[index];
+        if (key == null) {
+            key = ImpressionsSnapshot.joinKey(
+                    mPackages[index], mUserIds[index], mChannelIds[index]);
+            mKeys[index] = key;
+        }
+        return key;
+    }
+
+    int dismissalsAt(int index) {
+        return mDismissals[index];
+    }
+
+    int viewsAt(int index) {
+        return mViews[index];
+    }
+
+    int streakAt(int index) {
+        return mStreaks[index];
+    }
+
+    long lastUpdatedMsAt(int index) {
+        return mLastUpdatedMs[index];
+    }
+
+    void setLastUpdatedMsAt(int index, long lastUpdatedMs) {
+        mLastUpdatedMs[index] = lastUpdatedMs;
+    }
+
+    void incrementDismissalsAt(int index) {
+        mDismissals[index]++;
+        mStreaks[index]++;
+    }
+
+    void incrementViewsAt(int index) {
+        mViews[index]++;
+    }
+
+    void resetStreakAt(int index) {
+        mStreaks[index] = 0;
+    }
+
+    /** Sets the blocking helper thresholds for every channel. */
+    void setThresholds(float dismissToViewRatioLimit, int streakLimit) {
+        mDismissToViewRatioLimit = dismissToViewRatioLimit;
+        mStreakLimit = streakLimit;
+    }
+
+    /** Same as {@link ChannelImpressions#shouldTriggerBlock()}, for the entry at {@code index}. */
+    boolean shouldTriggerBlockAt(int index) {
+        final int views = mViews[index];
+        if (views == 0) {
+            return false;
+        }
+        if (DEBUG) {
+            Log.d(TAG, "should trigger? " + mDismissals[index] + " " + views + " "
+                    + mStreaks[index]);
+        }
+        return ((float) mDismissals[index] / views) > mDismissToViewRatioLimit
+                && mStreaks[index] > mStreakLimit;
+    }
+
+    /** Returns a detached copy of the entry at {@code index}, with the table's thresholds. */
+    ChannelImpressions getImpressionsAt(int index) {
+        final ChannelImpressions ci = new ChannelImpressions();
+        ci.setCounts(mDismissals[index], mViews[index], mStreaks[index]);
+        ci.setLastUpdatedMs(mLastUpdatedMs[index]);
+        ci.updateThresholds(mDismissToViewRatioLimit, mStreakLimit);
+        return ci;
+    }
+
+    /** Removes the entry at {@code index}, moving the last entry into its place. */
+    void removeAt(int index) {
+        removeSlot(findSlot(index));
+        final int last = --mSize;
+        if (index != last) {
+            mSlots[findSlot(last)] = index + 1;
+            mPackages[index] = mPackages[last];
+            mUserIds[index] = mUserIds[last];
+            mChannelIds[index] = mChannelIds[last];
+            mHashes[index] = mHashes[last];
+            mKeys[index] = mKeys[last];
+            mDismissals[index] = mDismissals[last];
+            mViews[index] = mViews[last];
+            mStreaks[index] = mStreaks[last];
+            mLastUpdatedMs[index] = mLastUpdatedMs[last];
+        }
+        mPackages[last] = null;
+        mChannelIds[last] = null;
+        mKeys[last] = null;
+    }
+
+    void clear() {
+        Arrays.fill(mSlots, 0);
+        Arrays.fill(mPackages, 0, mSize, null);
+        Arrays.fill(mChannelIds, 0, mSize, null);
+        Arrays.fill(mKeys, 0, mSize, null);
+        mSize = 0;
+    }
+
+    private static int hash(String pkg, int userId, String channelId) {
+        // String caches its hash code, so this is cheap for strings that are reused.
+        int h = (pkg.hashCode() * 31 + userId) * 31 + channelId.hashCode();
+        return h ^ (h >>> 16);
+    }
+
+    private int findEmptySlot(int hash) {
+        final int mask = mSlots.length - 1;
+        int slot = hash & mask;
+        while (mSlots[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    /** Returns the index slot that points at the entry at {@code index}. */
+    private int findSlot(int index) {
+        final int mask = mSlots.length - 1;
+        int slot = mHashes[index] & mask;
+        while (mSlots[slot] != index + 1) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    /**
+     * Empties {@code slot}, shifting back any later entries of the same probe run that can no
+     * longer be reached past the gap, so that no tombstones are needed.
+     */
+    private void removeSlot(int slot) {
+        final int mask = mSlots.length - 1;
+        int gap = slot;
+        int next = (gap + 1) & mask;
+        while (mSlots[next] != 0) {
+            final int home = mHashes[mSlots[next] - 1] & mask;
+            // Move the entry into the gap unless its home lies cyclically within (gap, next].
+            if (((next - home) & mask) >= ((next - gap) & mask)) {
+                mSlots[gap] = mSlots[next];
+                gap = next;
+            }
+            next = (next + 1) & mask;
+        }
+        mSlots[gap] = 0;
+    }
+
+    private void grow() {
+        final int capacity = mDismissals.length * 2;
+        mPackages = Arrays.copyOf(mPackages, capacity);
+        mUserIds = Arrays.copyOf(mUserIds, capacity);
+        mChannelIds = Arrays.copyOf(mChannelIds, capacity);
+        mHashes = Arrays.copyOf(mHashes, capacity);
+        mKeys = Arrays.copyOf(mKeys, capacity);
+        mDismissals = Arrays.copyOf(mDismissals, capacity);
+        mViews = Arrays.copyOf(mViews, capacity);
+        mStreaks = Arrays.copyOf(mStreaks, capacity);
+        mLastUpdatedMs = Arrays.copyOf(mLastUpdatedMs, capacity);
+        mSlots = new int[capacity * 2];
+        for (int i = 0; i < mSize; i++) {
+            mSlots[findEmptySlot(mHashes[i])] = i + 1;
+        }
+    }
+}
@@ -0,0 +1,253 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.annotation.Nullable;
+import android.app.Person;
+import android.text.TextUtils;
+import android.view.textclassifier.ConversationActions;
+
+import com.android.internal.annotations.GuardedBy;
+import com.android.internal.annotations.VisibleForTesting;
+
+import java.time.ZonedDateTime;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Objects;
+
+/**
+ * Caches the conversation actions suggested for a conversation, by the messages sent to the
+ * text classifier and the request options.
+ *
+ * <p>Apps re-post a conversation with the same messages whenever anything else about the
+ * notification changes, and each version is enqueued again; those ask for the same suggestions.
+ * Results are kept for a limited time, since the classifier's answer can change, and the cache
+ * drops the oldest result once full.
+ */
+final class ConversationActionsCache {
+    private static final long FNV_OFFSET_BASIS = 0xcbf29ce484222325L;
+    private static final long FNV_PRIME = 0x100000001b3L;
+
+    private final int mCapacity;
+    private final long mTtlMs;
+
+    private final Object mLock = new Object();
+    // request : result, oldest first
+    @GuardedBy("mLock")
+    private final LinkedHashMap<Key, Result> mResults = new LinkedHashMap<>();
+    @GuardedBy("mLock")
+    private long mHits;
+    @GuardedBy("mLock")
+    private long mMisses;
+    @GuardedBy("mLock")
+    private long mSavedMs;
+
+    private static final class Result {
+        final ConversationActions actions;
+        final long createdMs;
+        // How long the classifier took to suggest the actions.
+        final long costMs;
+
+        Result(ConversationActions actions, long createdMs, long costMs) {
+            this.actions = actions;
+            this.createdMs = createdMs;
+            this.costMs = costMs;
+        }
+    }
+
+    /**
+     * What a result is cached by: everything about the messages that is sent to the classifier,
+     * and the request options. Hashed by a fingerprint of all of it, and compared in full, so
+     * that a collision never serves one conversation's suggestions to another.
+     */
+    static final class Key {
+        private final List<ConversationActions.Message> mMessages;
+        private final boolean mIncludeReplies;
+        private final boolean mIncludeActions;
+        private final int mMaxSuggestions;
+        private final long mFingerprint;
+
+        Key(@NonNull List<ConversationActions.Message> messages, boolean includeReplies,
+                boolean includeActions, int maxSuggestions) {
+            this(messages, includeReplies, includeActions, maxSuggestions,
+                    fingerprint(messages, includeReplies, includeActions, maxSuggestions));
+        }
+
+        @VisibleForTesting
+        Key(@NonNull List<ConversationActions.Message> messages, boolean includeReplies,
+                boolean includeActions, int maxSuggestions, long fingerprint) {
+            mMessages = messages;
+            mIncludeReplies = includeReplies;
+            mIncludeActions = includeActions;
+            mMaxSuggestions = maxSuggestions;
+            mFingerprint = fingerprint;
+        }
+
+        @Override
+        public int hashCode() {
+            return Long.hashCode(mFingerprint);
+        }
+
+        @Override
+        public boolean equals(Object o) {
+            if (this == o) {
+                return true;
+            }
+            if (!(o instanceof Key)) {
+                return false;
+            }
+            final Key other = (Key) o;
+            if (mFingerprint != other.mFingerprint
+                    || mIncludeReplies != other.mIncludeReplies
+                    || mIncludeActions != other.mIncludeActions
+                    || mMaxSuggestions != other.mMaxSuggestions
+                    || mMessages.size() != other.mMessages.size()) {
+                return false;
+            }
+            for (int i = 0; i < mMessages.size(); i++) {
+                if (!isSameMessage(mMessages.get(i), other.mMessages.get(i))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        private static boolean isSameMessage(
+                ConversationActions.Message left, ConversationActions.Message right) {
+            final Person leftAuthor = left.getAuthor();
+            final Person rightAuthor = right.getAuthor();
+            return Objects.equals(leftAuthor.getKey(), rightAuthor.getKey())
+                    && TextUtils.equals(leftAuthor.getName(), rightAuthor.getName())
+                    && Objects.equals(leftAuthor.getUri(), rightAuthor.getUri())
+                    && TextUtils.equals(left.getText(), right.getText())
+                    && Objects.equals(left.getReferenceTime(), right.getReferenceTime());
+        }
+    }
+
+    ConversationActionsCache(int capacity, long ttlMs) {
+        mCapacity = capacity;
+        mTtlMs = ttlMs;
+    }
+
+    /** Returns the actions suggested for the request, or null if they have to be asked for. */
+    @Nullable
+    ConversationActions get(@NonNull Key key, long nowMs) {
+        synchronized (mLock) {
+            final Result result = mResults.get(key);
+            if (result == null || nowMs - result.createdMs > mTtlMs) {
+                if (result != null) {
+                    mResults.remove(key);
+                }
+                mMisses++;
+                return null;
+            }
+            mHits++;
+            mSavedMs += result.costMs;
+            return result.actions;
+        }
+    }
+
+    /** Stores the actions the classifier suggested for the request in {@code costMs}. */
+    void put(@NonNull Key key, @NonNull ConversationActions actions, long nowMs, long costMs) {
+        synchronized (mLock) {
+            mResults.remove(key);
+            if (mResults.size() >= mCapacity) {
+                final Iterator<Result> oldest = mResults.values().iterator();
+                oldest.next();
+                oldest.remove();
+            }
+            mResults.put(key, new Result(actions, nowMs, costMs));
+        }
+    }
+
+    void clear() {
+        synchronized (mLock) {
+            mResults.clear();
+        }
+    }
+
+    long getHitCount() {
+        synchronized (mLock) {
+            return mHits;
+        }
+    }
+
+    long getMissCount() {
+        synchronized (mLock) {
+            return mMisses;
+        }
+    }
+
+    /** Classifier time that hits did not spend, going by what the cached results cost. */
+    long getSavedMs() {
+        synchronized (mLock) {
+            return mSavedMs;
+        }
+    }
+
+    /**
+     * Returns a 64-bit FNV-1a hash of everything about the messages that is sent to the
+     * classifier, and of the request options.
+     */
+    static long fingerprint(@NonNull List<ConversationActions.Message> messages,
+            boolean includeReplies, boolean includeActions, int maxSuggestions) {
+        long hash = FNV_OFFSET_BASIS;
+        hash = mix(hash, (includeReplies ? 1 : 0) | (includeActions ? 2 : 0));
+        hash = mix(hash, maxSuggestions);
+        for (ConversationActions.Message message : messages) {
+            final Person author = message.getAuthor();
+            hash = mix(hash, author.getKey());
+            hash = mix(hash, author.getName());
+            hash = mix(hash, author.getUri());
+            hash = mix(hash, message.getText());
+            final ZonedDateTime referenceTime = message.getReferenceTime();
+            hash = mix(hash, referenceTime == null
+                    ? Long.MIN_VALUE : referenceTime.toInstant().toEpochMilli());
+        }
+        return hash;
+    }
+
+    private static long mix(long hash, @Nullable CharSequence text) {
+        if (text == null) {
+            return mix(hash, -1);
+        }
+        final int length = text.length();
+        for (int i = 0; i < length; i++) {
+            hash = (hash ^ text.charAt(i)) * FNV_PRIME;
+        }
+        // Terminated by the length, so that the boundaries between strings count.
+        return mix(hash, length);
+    }
+
+    private static long mix(long hash, int value) {
+        for (int i = 0; i < Integer.BYTES; i++) {
+            hash = (hash ^ (value & 0xff)) * FNV_PRIME;
+            value >>>= 8;
+        }
+        return hash;
+    }
+
+    private static long mix(long hash, long value) {
+        for (int i = 0; i < Long.BYTES; i++) {
+            hash = (hash ^ (value & 0xff)) * FNV_PRIME;
+            value >>>= 8;
+        }
+        return hash;
+    }
+}
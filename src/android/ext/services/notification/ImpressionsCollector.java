@@ -0,0 +1,286 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.annotation.Nullable;
+import android.os.Handler;
+import android.os.SystemClock;
+import android.util.Slog;
+
+import com.android.internal.annotations.GuardedBy;
+import com.android.internal.annotations.VisibleForTesting;
+
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * Removes impressions for channels that no longer matter: those of uninstalled packages, deleted
+ * channels, and channels that have not been used for longer than the maximum age.
+ *
+ * <p>The in-memory map is swept incrementally on the handler's thread, a bounded slice at a time,
+ * so that the lock on the map is never held for long. Records of the mapped snapshot that were
+ * never promoted are dropped the next time a snapshot is written, through
+ * {@link #shouldDrop(String, long)}; until then the collector also stops them from being
+ * promoted again.
+ */
+final class ImpressionsCollector implements ImpressionsSnapshot.Filter {
+    private static final String TAG = "ExtAssistant.GC";
+
+    @VisibleForTesting
+    static final int SLICE_MAX_ENTRIES = 256;
+    private static final long SLICE_MAX_MS = 4;
+    // Rough heap cost of a table entry: its columns, its index slots and the key strings' object
+    // headers; the keys' characters are added on top.
+    private static final int ENTRY_OVERHEAD_BYTES = 88;
+
+    private final Handler mHandler;
+    private final ChannelImpressionsTable mImpressions;
+    private final Runnable mOnCollected;
+    private final Runnable mSliceRunnable = this::sweepSlice;
+
+    // All guarded by mImpressions, which is also the lock of the owner's table.
+    // Removed packages and deleted channels not yet applied to a committed snapshot.
+    @GuardedBy("mImpressions")
+    private final ArrayList<Removal> mRemovals = new ArrayList<>();
+    @GuardedBy("mImpressions")
+    private long mMaxAgeMs;
+    @GuardedBy("mImpressions")
+    private long mCutoffMs;
+    // Next index of the map to look at, or -1 if no sweep is running.
+    @GuardedBy("mImpressions")
+    private int mCursor = -1;
+    @GuardedBy("mImpressions")
+    private boolean mRescheduled;
+    @GuardedBy("mImpressions")
+    private int mSweepReclaimed;
+    @GuardedBy("mImpressions")
+    private long mSweeps;
+    @GuardedBy("mImpressions")
+    private long mReclaimedEntries;
+    @GuardedBy("mImpressions")
+    private long mReclaimedBytes;
+    @GuardedBy("mImpressions")
+    private long mDroppedRecords;
+
+    /**
+     * @param handler runs the sweep
+     * @param impressions the table to sweep; all access to it is synchronized on the table
+     * @param onCollected run on the handler's thread after a sweep that removed anything, or
+     *                    when there are records to drop from the snapshot
+     */
+    ImpressionsCollector(@NonNull Handler handler, @NonNull ChannelImpressionsTable impressions,
+            long maxAgeMs, @NonNull Runnable onCollected) {
+        mHandler = handler;
+        mImpressions = impressions;
+        mMaxAgeMs = maxAgeMs;
+        mOnCollected = onCollected;
+    }
+
+    void setMaxAgeMs(long maxAgeMs) {
+        synchronized (mImpressions) {
+            mMaxAgeMs = maxAgeMs;
+        }
+    }
+
+    void onPackageRemoved(@NonNull String pkg, int userId) {
+        synchronized (mImpressions) {
+            mRemovals.add(new Removal(pkg, userId, null, System.currentTimeMillis()));
+        }
+        schedule();
+    }
+
+    void onChannelDeleted(@NonNull String pkg, int userId, @NonNull String channelId) {
+        synchronized (mImpressions) {
+            mRemovals.add(new Removal(pkg, userId, channelId, System.currentTimeMillis()));
+        }
+        schedule();
+    }
+
+    /** Starts a sweep, or makes the running one go round again when it finishes. */
+    void schedule() {
+        synchronized (mImpressions) {
+            if (mCursor >= 0) {
+                mRescheduled = true;
+                return;
+            }
+            startSweepLocked();
+        }
+        mHandler.post(mSliceRunnable);
+    }
+
+    /**
+     * Whether the impressions for the given channel should be removed. Impressions updated after
+     * their package or channel was removed belong to a reinstalled package or recreated channel,
+     * and are kept. A last updated time of 0 is unknown and never ages; records stored without
+     * one are given their load time, so only entries built in memory can have it.
+     */
+    @GuardedBy("mImpressions")
+    boolean isStaleLocked(@NonNull String pkg, int userId, @NonNull String channelId,
+            long lastUpdatedMs) {
+        if (lastUpdatedMs != 0 && lastUpdatedMs < mCutoffMs) {
+            return true;
+        }
+        for (int i = mRemovals.size() - 1; i >= 0; i--) {
+            if (mRemovals.get(i).matches(pkg, userId, channelId, lastUpdatedMs)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Called while writing a snapshot, after {@link #beginWriteLocked()}. */
+    @Override
+    public boolean shouldDrop(@NonNull String pkg, int userId, @NonNull String channelId,
+            long lastUpdatedMs) {
+        synchronized (mImpressions) {
+            return isStaleLocked(pkg, userId, channelId, lastUpdatedMs);
+        }
+    }
+
+    /**
+     * Prepares for writing a snapshot and captures the removals it will apply. Once the snapshot
+     * is committed, pass the result to {@link #onSnapshotCommitted} to forget them; removals
+     * that arrive in between are kept for the next snapshot.
+     */
+    @GuardedBy("mImpressions")
+    List<Removal> beginWriteLocked() {
+        mCutoffMs = System.currentTimeMillis() - mMaxAgeMs;
+        return new ArrayList<>(mRemovals);
+    }
+
+    /**
+     * Whether there are removals not yet applied to a committed snapshot. Until they are, they
+     * are only held in memory, and a restart would bring the removed impressions back.
+     */
+    boolean hasPendingRemovals() {
+        synchronized (mImpressions) {
+            return !mRemovals.isEmpty();
+        }
+    }
+
+    /** Forgets the removals applied by a snapshot that has now been committed. */
+    void onSnapshotCommitted(@NonNull List<Removal> removals, int droppedRecords) {
+        synchronized (mImpressions) {
+            mRemovals.removeAll(removals);
+            mDroppedRecords += droppedRecords;
+        }
+    }
+
+    long getSweepCount() {
+        synchronized (mImpressions) {
+            return mSweeps;
+        }
+    }
+
+    long getReclaimedEntries() {
+        synchronized (mImpressions) {
+            return mReclaimedEntries;
+        }
+    }
+
+    long getReclaimedBytes() {
+        synchronized (mImpressions) {
+            return mReclaimedBytes;
+        }
+    }
+
+    /** Records left out of snapshots, mostly ones that had never been promoted into memory. */
+    long getDroppedRecords() {
+        synchronized (mImpressions) {
+            return mDroppedRecords;
+        }
+    }
+
+    /** A removed package, or a deleted channel if {@code channelId} is set. */
+    static final class Removal {
+        private final String mPackage;
+        private final int mUserId;
+        @Nullable
+        private final String mChannelId;
+        private final long mRemovedMs;
+
+        private Removal(String pkg, int userId, @Nullable String channelId, long removedMs) {
+            mPackage = pkg;
+            mUserId = userId;
+            mChannelId = channelId;
+            mRemovedMs = removedMs;
+        }
+
+        boolean matches(String pkg, int userId, String channelId, long lastUpdatedMs) {
+            return mUserId == userId && lastUpdatedMs <= mRemovedMs && mPackage.equals(pkg)
+                    && (mChannelId == null || mChannelId.equals(channelId));
+        }
+    }
+
+    @GuardedBy("mImpressions")
+    private void startSweepLocked() {
+        mCursor = 0;
+        mRescheduled = false;
+        mSweepReclaimed = 0;
+        mCutoffMs = System.currentTimeMillis() - mMaxAgeMs;
+    }
+
+    /**
+     * Looks at a bounded number of entries. Entries can move while the lock is released between
+     * slices, so a sweep may miss some; they are picked up by the next one.
+     */
+    @VisibleForTesting
+    void sweepSlice() {
+        final long deadline = SystemClock.uptimeMillis() + SLICE_MAX_MS;
+        final boolean collected;
+        synchronized (mImpressions) {
+            if (mCursor < 0) {
+                return;
+            }
+            int visited = 0;
+            while (mCursor < mImpressions.size() && visited < SLICE_MAX_ENTRIES
+                    && SystemClock.uptimeMillis() < deadline) {
+                final String pkg = mImpressions.packageAt(mCursor);
+                final String channelId = mImpressions.channelIdAt(mCursor);
+                if (isStaleLocked(pkg, mImpressions.userIdAt(mCursor), channelId,
+                        mImpressions.lastUpdatedMsAt(mCursor))) {
+                    mImpressions.removeAt(mCursor);
+                    mSweepReclaimed++;
+                    mReclaimedEntries++;
+                    mReclaimedBytes +=
+                            ENTRY_OVERHEAD_BYTES + 2 * (pkg.length() + channelId.length());
+                } else {
+                    mCursor++;
+                }
+                visited++;
+            }
+            if (mCursor < mImpressions.size()) {
+                mHandler.post(mSliceRunnable);
+                return;
+            }
+            mSweeps++;
+            Slog.i(TAG, "Reclaimed " + mSweepReclaimed + " channel impressions, "
+                    + mReclaimedEntries + " entries (~" + mReclaimedBytes + " bytes) in total");
+            collected = mSweepReclaimed > 0 || !mRemovals.isEmpty();
+            if (mRescheduled) {
+                startSweepLocked();
+                mHandler.post(mSliceRunnable);
+            } else {
+                mCursor = -1;
+            }
+        }
+        if (collected) {
+            mOnCollected.run();
+        }
+    }
+}
@@ -0,0 +1,277 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.util.ArrayMap;
+import android.util.Log;
+import android.util.SparseArray;
+
+import libcore.io.IoUtils;
+
+import java.io.BufferedInputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.DataInputStream;
+import java.io.DataOutputStream;
+import java.io.EOFException;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileNotFoundException;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.RandomAccessFile;
+import java.nio.ByteBuffer;
+import java.nio.charset.StandardCharsets;
+import java.util.List;
+import java.util.zip.CRC32;
+
+/**
+ * Append-only log of changes to channel impressions made since the last
+ * {@link ImpressionsSnapshot}.
+ *
+ * <p>The file starts with a header (magic, version, generation) followed by records of the form
+ * (type, uint16 length, payload, CRC32). A key record assigns a small id to a channel key the
+ * first time it is used in this generation; delta records then refer to the key by id, so each
+ * change costs a few bytes however many channels there are.
+ *
+ * <p>The generation ties the journal to the snapshot it applies to. Compaction commits a new
+ * snapshot with the next generation before resetting the journal, so a journal left over from a
+ * crash in between is recognised as stale and ignored. A record that fails its checksum, which is
+ * what a crash in the middle of an append leaves behind, ends replay and is truncated away.
+ *
+ * <p>Not thread safe; all calls must be made on the same thread.
+ */
+final class ImpressionsJournal {
+    private static final String TAG = "ExtAssistant.Journal";
+
+    static final int MAGIC = 0x4e41534a; // "NASJ"
+    static final int VERSION = 1;
+    static final int HEADER_SIZE = 3 * Integer.BYTES;
+
+    static final int OP_VIEW = 1;
+    static final int OP_DISMISSAL = 2;
+    static final int OP_RESET_STREAK = 3;
+
+    private static final int TYPE_KEY = 1;
+    private static final int TYPE_DELTA = 2;
+    // type + length + crc
+    private static final int RECORD_OVERHEAD = 1 + Short.BYTES + Integer.BYTES;
+
+    /** A single change to the impressions of one channel. */
+    static final class Delta {
+        final String key;
+        final int op;
+
+        Delta(@NonNull String key, int op) {
+            this.key = key;
+            this.op = op;
+        }
+    }
+
+    /** Receives the deltas read back from the journal, in the order they were appended. */
+    interface Visitor {
+        void onDelta(@NonNull String key, int op);
+    }
+
+    private final File mFile;
+    private final ArrayMap<String, Integer> mKeyIds = new ArrayMap<>();
+    private final CRC32 mCrc = new CRC32();
+    private int mGeneration;
+    private long mLength;
+    private FileOutputStream mOut;
+
+    ImpressionsJournal(@NonNull File file) {
+        mFile = file;
+    }
+
+    /**
+     * Replays the journal if it belongs to the snapshot of the given generation, and prepares it
+     * for appending. A missing, stale or unreadable journal is reset to the given generation.
+     *
+     * @return the number of deltas replayed
+     */
+    int replay(int generation, @NonNull Visitor visitor) throws IOException {
+        close();
+        mKeyIds.clear();
+        final SparseArray<String> keys = new SparseArray<>();
+        long valid;
+        int replayed = 0;
+        DataInputStream in = null;
+        try {
+            in = new DataInputStream(new BufferedInputStream(new FileInputStream(mFile)));
+            if (in.readInt() != MAGIC || in.readInt() > VERSION || in.readInt() != generation) {
+                if (Log.isLoggable(TAG, Log.DEBUG)) Log.d(TAG, "Discarding stale journal");
+                reset(generation);
+                return 0;
+            }
+            valid = HEADER_SIZE;
+            byte[] payload;
+            while ((payload = readRecord(in)) != null) {
+                final ByteBuffer buffer = ByteBuffer.wrap(payload, 1, payload.length - 1);
+                final int id = buffer.getInt();
+                if (payload[0] == TYPE_KEY) {
+                    final String key = new String(payload, 1 + Integer.BYTES,
+                            payload.length - 1 - Integer.BYTES, StandardCharsets.UTF_8);
+                    keys.put(id, key);
+                    mKeyIds.put(key, id);
+                } else if (payload[0] == TYPE_DELTA) {
+                    final String key = keys.get(id);
+                    if (key != null) {
+                        visitor.onDelta(key, buffer.get());
+                        replayed++;
+                    }
+                } else {
+                    break;
+                }
+                valid += RECORD_OVERHEAD + payload.length - 1;
+            }
+        } catch (FileNotFoundException | EOFException e) {
+            // No journal yet, or its header was never completely written.
+            reset(generation);
+            return 0;
+        } finally {
+            IoUtils.closeQuietly(in);
+        }
+
+        // Drop any torn record so that new records are appended after the last good one.
+        try (RandomAccessFile file = new RandomAccessFile(mFile, "rw")) {
+            if (file.length() != valid) {
+                Log.w(TAG, "Truncating " + (file.length() - valid) + " bytes of torn journal");
+                file.setLength(valid);
+            }
+        }
+        mGeneration = generation;
+        mLength = valid;
+        return replayed;
+    }
+
+    /**
+     * Appends the given deltas and syncs them to disk. If this throws, some of the deltas may
+     * not have been written; the caller should recover by compacting into a new snapshot.
+     */
+    void append(@NonNull List<Delta> deltas) throws IOException {
+        if (deltas.isEmpty()) {
+            return;
+        }
+        final ByteArrayOutputStream bytes = new ByteArrayOutputStream();
+        final DataOutputStream out = new DataOutputStream(bytes);
+        for (int i = 0; i < deltas.size(); i++) {
+            final Delta delta = deltas.get(i);
+            Integer id = mKeyIds.get(delta.key);
+            if (id == null) {
+                id = mKeyIds.size();
+                mKeyIds.put(delta.key, id);
+                final byte[] key = delta.key.getBytes(StandardCharsets.UTF_8);
+                writeRecord(out, TYPE_KEY,
+                        ByteBuffer.allocate(Integer.BYTES + key.length).putInt(id).put(key));
+            }
+            writeRecord(out, TYPE_DELTA,
+                    ByteBuffer.allocate(Integer.BYTES + 1).putInt(id).put((byte) delta.op));
+        }
+        if (mOut == null) {
+            mOut = new FileOutputStream(mFile, true);
+        }
+        try {
+            bytes.writeTo(mOut);
+            mOut.getFD().sync();
+        } catch (IOException e) {
+            close();
+            throw e;
+        }
+        mLength += bytes.size();
+    }
+
+    /** Starts an empty journal for the snapshot of the given generation. */
+    void reset(int generation) throws IOException {
+        close();
+        mKeyIds.clear();
+        final FileOutputStream out = new FileOutputStream(mFile, false);
+        try {
+            final DataOutputStream data = new DataOutputStream(out);
+            data.writeInt(MAGIC);
+            data.writeInt(VERSION);
+            data.writeInt(generation);
+            data.flush();
+            out.getFD().sync();
+        } catch (IOException e) {
+            IoUtils.closeQuietly(out);
+            throw e;
+        }
+        mOut = out;
+        mGeneration = generation;
+        mLength = HEADER_SIZE;
+    }
+
+    void close() {
+        IoUtils.closeQuietly(mOut);
+        mOut = null;
+    }
+
+    int getGeneration() {
+        return mGeneration;
+    }
+
+    /** Size of the journal in bytes, including the header. */
+    long length() {
+        return mLength;
+    }
+
+    /**
+     * Reads the next record and returns its type followed by its payload, or null if the rest of
+     * the file does not hold a complete, intact record.
+     */
+    private byte[] readRecord(DataInputStream in) throws IOException {
+        final int type = in.read();
+        if (type < 0) {
+            return null;
+        }
+        try {
+            final int length = in.readUnsignedShort();
+            if (length < Integer.BYTES) {
+                return null;
+            }
+            final byte[] record = new byte[1 + length];
+            record[0] = (byte) type;
+            in.readFully(record, 1, length);
+            final int checksum = in.readInt();
+            if (checksum != checksum(type, length, record, 1)) {
+                return null;
+            }
+            return record;
+        } catch (EOFException e) {
+            return null;
+        }
+    }
+
+    private void writeRecord(DataOutputStream out, int type, ByteBuffer payload)
+            throws IOException {
+        final byte[] bytes = payload.array();
+        out.writeByte(type);
+        out.writeShort(bytes.length);
+        out.write(bytes);
+        out.writeInt(checksum(type, bytes.length, bytes, 0));
+    }
+
+    private int checksum(int type, int length, byte[] payload, int offset) {
+        mCrc.reset();
+        mCrc.update(type);
+        mCrc.update(length >> 8);
+        mCrc.update(length);
+        mCrc.update(payload, offset, length);
+        return (int) mCrc.getValue();
+    }
+}
@@ -0,0 +1,460 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.annotation.Nullable;
+
+import com.android.internal.annotations.VisibleForTesting;
+
+import java.io.BufferedOutputStream;
+import java.io.DataOutputStream;
+import java.io.FileInputStream;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.charset.StandardCharsets;
+import java.util.Arrays;
+import java.util.HashMap;
+import java.util.Map;
+import java.util.TreeSet;
+import java.util.zip.CRC32;
+import java.util.zip.CheckedOutputStream;
+
+/**
+ * Compact binary encoding of the channel impressions database.
+ *
+ * <p>All values are big-endian. The file consists of:
+ * <pre>
+ *   header:  magic, version, record size, string count, record count,
+ *            generation                                               (6 x int32)
+ *   strings: string count x (uint16 length, UTF-8 bytes), sorted by those bytes
+ *   records: record count x record size bytes, sorted by (pkg, user, channel)
+ *   trailer: CRC32 of everything above                                  (int32)
+ * </pre>
+ * Package names and channel ids are interned into the string table and records refer to them
+ * by index, so each record is fixed width. The record size is stored in the header so that
+ * fields can be appended to a record without breaking older files. The generation identifies the
+ * {@link ImpressionsJournal} that applies on top of this snapshot; version 1 files have none and
+ * are treated as generation 0.
+ */
+final class ImpressionsSnapshot {
+    static final int MAGIC = 0x4e415349; // "NASI"
+    static final int VERSION = 2;
+
+    // pkg index, user id, channel index, dismissals, views, streak, last updated (int64)
+    static final int RECORD_SIZE = 8 * Integer.BYTES;
+    // Records written before the last updated time was added.
+    private static final int MIN_RECORD_SIZE = 6 * Integer.BYTES;
+    private static final int HEADER_SIZE = 6 * Integer.BYTES;
+    private static final int HEADER_SIZE_V1 = 5 * Integer.BYTES;
+    private static final int MAX_STRING_BYTES = 0xffff;
+
+    private ImpressionsSnapshot() {
+    }
+
+    /** Selects records to leave out of a snapshot. */
+    interface Filter {
+        boolean shouldDrop(@NonNull String pkg, int userId, @NonNull String channelId,
+                long lastUpdatedMs);
+    }
+
+    /**
+     * Encodes {@code impressions} to {@code out}. The stream is flushed but not closed, so that
+     * callers can hand it back to {@link android.util.AtomicFile#finishWrite}.
+     *
+     * @param base a previous snapshot whose records are carried over unless {@code impressions}
+     *             has an entry for the same key
+     * @param filter if not null, records it selects are left out
+     * @return the number of records left out by {@code filter}
+     */
+    static int write(@NonNull OutputStream out,
+            @NonNull ChannelImpressionsTable impressions, int generation,
+            @Nullable Mapped base, @Nullable Filter filter) throws IOException {
+        // Pick the records to keep: positions in the table, then record numbers in base.
+        final int[] kept = new int[impressions.size()];
+        int keptCount = 0;
+        // In the order of their UTF-8 bytes, which is how Mapped searches them.
+        final TreeSet<String> strings = new TreeSet<>(ImpressionsSnapshot::compareCodePoints);
+        int dropped = 0;
+        for (int i = 0; i < impressions.size(); i++) {
+            if (filter != null && filter.shouldDrop(impressions.packageAt(i),
+                    impressions.userIdAt(i), impressions.channelIdAt(i),
+                    impressions.lastUpdatedMsAt(i))) {
+                dropped++;
+                continue;
+            }
+            kept[keptCount++] = i;
+            strings.add(impressions.packageAt(i));
+            strings.add(impressions.channelIdAt(i));
+        }
+        final int[] keptBase = new int[base != null ? base.size() : 0];
+        int keptBaseCount = 0;
+        for (int i = 0; i < keptBase.length; i++) {
+            String pkg = base.getPackage(i);
+            int userId = base.getUserId(i);
+            String channelId = base.getChannelId(i);
+            if (impressions.indexOf(pkg, userId, channelId) >= 0) {
+                continue;
+            }
+            if (filter != null
+                    && filter.shouldDrop(pkg, userId, channelId, base.getLastUpdatedMs(i))) {
+                dropped++;
+                continue;
+            }
+            keptBase[keptBaseCount++] = i;
+            strings.add(pkg);
+            strings.add(channelId);
+        }
+
+        final String[] table = strings.toArray(new String[strings.size()]);
+        final Map<String, Integer> index = new HashMap<>(table.length * 2);
+        for (int i = 0; i < table.length; i++) {
+            index.put(table[i], i);
+        }
+
+        final int n = keptCount + keptBaseCount;
+        final int[][] records = new int[n][];
+        for (int k = 0; k < keptCount; k++) {
+            final int i = kept[k];
+            final long lastUpdatedMs = impressions.lastUpdatedMsAt(i);
+            records[k] = new int[] {
+                    index.get(impressions.packageAt(i)), impressions.userIdAt(i),
+                    index.get(impressions.channelIdAt(i)), impressions.dismissalsAt(i),
+                    impressions.viewsAt(i), impressions.streakAt(i),
+                    (int) (lastUpdatedMs >>> 32), (int) lastUpdatedMs};
+        }
+        for (int k = 0; k < keptBaseCount; k++) {
+            final int i = keptBase[k];
+            final long lastUpdatedMs = base.getLastUpdatedMs(i);
+            records[keptCount + k] = new int[] {
+                    index.get(base.getPackage(i)), base.getUserId(i),
+                    index.get(base.getChannelId(i)), base.getDismissals(i), base.getViews(i),
+                    base.getStreak(i), (int) (lastUpdatedMs >>> 32), (int) lastUpdatedMs};
+        }
+        Arrays.sort(records, ImpressionsSnapshot::compareRecords);
+
+        final CRC32 crc = new CRC32();
+        final DataOutputStream data =
+                new DataOutputStream(new CheckedOutputStream(new BufferedOutputStream(out), crc));
+        data.writeInt(MAGIC);
+        data.writeInt(VERSION);
+        data.writeInt(RECORD_SIZE);
+        data.writeInt(table.length);
+        data.writeInt(n);
+        data.writeInt(generation);
+        for (String s : table) {
+            byte[] bytes = s.getBytes(StandardCharsets.UTF_8);
+            if (bytes.length > MAX_STRING_BYTES) {
+                throw new IOException("String too long for impressions table: " + s);
+            }
+            data.writeShort(bytes.length);
+            data.write(bytes);
+        }
+        for (int[] record : records) {
+            for (int field : record) {
+                data.writeInt(field);
+            }
+        }
+        data.writeInt((int) crc.getValue());
+        data.flush();
+        return dropped;
+    }
+
+    /** Inverse of {@link #splitKey}; matches {@code Assistant.getKey}. */
+    static String joinKey(String pkg, int userId, String channelId) {
+        return pkg + "|" + userId + "|" + channelId;
+    }
+
+    /**
+     * Splits a {@code pkg|userId|channelId} key into its parts, or returns null if the key is
+     * malformed. Package names cannot contain '|', so the channel id is everything after the
+     * second separator.
+     */
+    static String[] splitKey(String key) {
+        final int first = key.indexOf('|');
+        final int second = first < 0 ? -1 : key.indexOf('|', first + 1);
+        if (second < 0) {
+            return null;
+        }
+        final String userId = key.substring(first + 1, second);
+        try {
+            Integer.parseInt(userId);
+        } catch (NumberFormatException e) {
+            return null;
+        }
+        return new String[] {key.substring(0, first), userId, key.substring(second + 1)};
+    }
+
+    /**
+     * Read-only view of a snapshot file mapped into memory. Records are found by binary search
+     * when they are first needed rather than all being decoded up front, which keeps startup
+     * heap independent of how many channels have history. Thread safe.
+     *
+     * <p>Verifying a snapshot reads every page of it once, to check its checksum and record
+     * indices, so it should only be done off the main thread. Snapshots this process has just
+     * committed can be mapped without it.
+     */
+    static final class Mapped {
+        private final ByteBuffer mBuffer;
+        // Offset of each string's length prefix in the string table.
+        private final int[] mStringOffsets;
+        private final int mRecordsOffset;
+        private final int mRecordSize;
+        private final int mRecordCount;
+        private final int mGeneration;
+        // Given as the last updated time of records stored without one, so that they age from
+        // when they were first loaded instead of never.
+        private final long mMappedMs = System.currentTimeMillis();
+
+        /**
+         * Maps the file behind {@code in}; the mapping outlives the stream.
+         *
+         * @param verify whether to check the whole file before using it
+         */
+        static Mapped map(@NonNull FileInputStream in, boolean verify) throws IOException {
+            final FileChannel channel = in.getChannel();
+            return new Mapped(
+                    channel.map(FileChannel.MapMode.READ_ONLY, 0, channel.size()), verify);
+        }
+
+        @VisibleForTesting
+        Mapped(@NonNull ByteBuffer buffer) throws IOException {
+            this(buffer, true);
+        }
+
+        private Mapped(@NonNull ByteBuffer buffer, boolean verify) throws IOException {
+            mBuffer = buffer;
+            final int limit = buffer.limit() - Integer.BYTES;
+            if (limit < HEADER_SIZE_V1) {
+                throw new IOException("Impressions snapshot too short");
+            }
+            if (verify) {
+                final ByteBuffer covered = buffer.duplicate();
+                covered.position(0);
+                covered.limit(limit);
+                final CRC32 crc = new CRC32();
+                crc.update(covered);
+                if ((int) crc.getValue() != buffer.getInt(limit)) {
+                    throw new IOException("Impressions snapshot checksum mismatch");
+                }
+            }
+
+            if (buffer.getInt(0) != MAGIC) {
+                throw new IOException("Not an impressions snapshot");
+            }
+            final int version = buffer.getInt(4);
+            if (version > VERSION) {
+                throw new IOException("Unsupported impressions snapshot version " + version);
+            }
+            mRecordSize = buffer.getInt(8);
+            final int stringCount = buffer.getInt(12);
+            mRecordCount = buffer.getInt(16);
+            mGeneration = version >= 2 ? buffer.getInt(20) : 0;
+            if (mRecordSize < MIN_RECORD_SIZE || mRecordSize % Integer.BYTES != 0
+                    || stringCount < 0 || mRecordCount < 0) {
+                throw new IOException("Corrupt impressions snapshot header");
+            }
+
+            int offset = version >= 2 ? HEADER_SIZE : HEADER_SIZE_V1;
+            // Each string takes at least its length prefix.
+            if (stringCount > (limit - offset) / Short.BYTES) {
+                throw new IOException("Corrupt impressions snapshot string table");
+            }
+            mStringOffsets = new int[stringCount];
+            for (int i = 0; i < stringCount; i++) {
+                if (offset + Short.BYTES > limit) {
+                    throw new IOException("Corrupt impressions snapshot string table");
+                }
+                mStringOffsets[i] = offset;
+                offset += Short.BYTES + (buffer.getShort(offset) & 0xffff);
+            }
+            mRecordsOffset = offset;
+            if ((long) mRecordsOffset + (long) mRecordCount * mRecordSize != limit) {
+                throw new IOException("Corrupt impressions snapshot records");
+            }
+            for (int i = 0; verify && i < mRecordCount; i++) {
+                if (field(i, 0) < 0 || field(i, 0) >= stringCount
+                        || field(i, 2) < 0 || field(i, 2) >= stringCount) {
+                    throw new IOException("Corrupt impressions snapshot record");
+                }
+            }
+        }
+
+        int getGeneration() {
+            return mGeneration;
+        }
+
+        /**
+         * Whether the file stores when each record was last updated. Files that do not should be
+         * rewritten, so that the time they were mapped at is kept.
+         */
+        boolean hasLastUpdatedTimes() {
+            return mRecordSize >= 8 * Integer.BYTES;
+        }
+
+        int size() {
+            return mRecordCount;
+        }
+
+        /** Size of the mapped file, in bytes. */
+        int getBytes() {
+            return mBuffer.limit();
+        }
+
+        /** Returns the index of the record for the given channel, or -1 if there is none. */
+        int find(@NonNull String pkg, int userId, @NonNull String channelId) {
+            final int pkgIndex = findString(pkg);
+            if (pkgIndex < 0) {
+                return -1;
+            }
+            final int channelIndex = findString(channelId);
+            if (channelIndex < 0) {
+                return -1;
+            }
+            int lo = 0;
+            int hi = mRecordCount - 1;
+            while (lo <= hi) {
+                final int mid = (lo + hi) >>> 1;
+                int c = Integer.compare(field(mid, 0), pkgIndex);
+                if (c == 0) {
+                    c = Integer.compare(field(mid, 1), userId);
+                }
+                if (c == 0) {
+                    c = Integer.compare(field(mid, 2), channelIndex);
+                }
+                if (c < 0) {
+                    lo = mid + 1;
+                } else if (c > 0) {
+                    hi = mid - 1;
+                } else {
+                    return mid;
+                }
+            }
+            return -1;
+        }
+
+        String getPackage(int record) {
+            return getString(field(record, 0));
+        }
+
+        int getUserId(int record) {
+            return field(record, 1);
+        }
+
+        String getChannelId(int record) {
+            return getString(field(record, 2));
+        }
+
+        int getDismissals(int record) {
+            return field(record, 3);
+        }
+
+        int getViews(int record) {
+            return field(record, 4);
+        }
+
+        int getStreak(int record) {
+            return field(record, 5);
+        }
+
+        /**
+         * Returns when the record was last updated, or when the snapshot was mapped if the
+         * record does not say.
+         */
+        long getLastUpdatedMs(int record) {
+            if (!hasLastUpdatedTimes()) {
+                return mMappedMs;
+            }
+            final long lastUpdatedMs =
+                    ((long) field(record, 6) << 32) | (field(record, 7) & 0xffffffffL);
+            return lastUpdatedMs != 0 ? lastUpdatedMs : mMappedMs;
+        }
+
+        private int field(int record, int field) {
+            return mBuffer.getInt(mRecordsOffset + record * mRecordSize + field * Integer.BYTES);
+        }
+
+        private int findString(String s) {
+            final byte[] key = s.getBytes(StandardCharsets.UTF_8);
+            int lo = 0;
+            int hi = mStringOffsets.length - 1;
+            while (lo <= hi) {
+                final int mid = (lo + hi) >>> 1;
+                final int c = compareString(mid, key);
+                if (c < 0) {
+                    lo = mid + 1;
+                } else if (c > 0) {
+                    hi = mid - 1;
+                } else {
+                    return mid;
+                }
+            }
+            return -1;
+        }
+
+        /** Compares a string in the table to {@code key} without decoding it. */
+        private int compareString(int index, byte[] key) {
+            final int offset = mStringOffsets[index];
+            final int length = mBuffer.getShort(offset) & 0xffff;
+            final int n = Math.min(length, key.length);
+            for (int i = 0; i < n; i++) {
+                final int c = Integer.compare(
+                        mBuffer.get(offset + Short.BYTES + i) & 0xff, key[i] & 0xff);
+                if (c != 0) {
+                    return c;
+                }
+            }
+            return Integer.compare(length, key.length);
+        }
+
+        private String getString(int index) {
+            final int offset = mStringOffsets[index];
+            final byte[] bytes = new byte[mBuffer.getShort(offset) & 0xffff];
+            for (int i = 0; i < bytes.length; i++) {
+                bytes[i] = mBuffer.get(offset + Short.BYTES + i);
+            }
+            return new String(bytes, StandardCharsets.UTF_8);
+        }
+    }
+
+    /** Orders strings by code point, which is the order of their UTF-8 bytes. */
+    @VisibleForTesting
+    static int compareCodePoints(String a, String b) {
+        int i = 0;
+        while (i < a.length() && i < b.length()) {
+            final int ca = a.codePointAt(i);
+            final int cb = b.codePointAt(i);
+            if (ca != cb) {
+                return Integer.compare(ca, cb);
+            }
+            i += Character.charCount(ca);
+        }
+        return Integer.compare(a.length(), b.length());
+    }
+
+    private static int compareRecords(int[] a, int[] b) {
+        for (int i = 0; i < 3; i++) {
+            int c = Integer.compare(a[i], b[i]);
+            if (c != 0) {
+                return c;
+            }
+        }
+        return 0;
+    }
+}
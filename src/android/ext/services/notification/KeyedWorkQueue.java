@@ -0,0 +1,407 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.os.Process;
+import android.os.SystemClock;
+import android.util.ArrayMap;
+import android.util.Log;
+
+import com.android.internal.annotations.GuardedBy;
+import com.android.internal.annotations.VisibleForTesting;
+
+import java.util.ArrayDeque;
+import java.util.Iterator;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.atomic.AtomicInteger;
+import java.util.function.LongSupplier;
+
+/**
+ * Runs work on a small pool of threads, in submission order for each key and in parallel across
+ * keys.
+ *
+ * <p>Each key has a lane of pending tasks. A lane with work is handed to the pool one task at a
+ * time and goes to the back of the pool's queue after each task, so a key with a lot of work
+ * cannot starve the others.
+ *
+ * <p>The number of pending tasks is bounded; once it reaches the capacity, new tasks are
+ * rejected and {@link #submit} returns false. Tasks submitted with {@link #POLICY_DROP_IF_STALE}
+ * are dropped instead of run if they waited longer than the maximum wait, since their result
+ * would be out of date by then. Tasks submitted with {@link #POLICY_LATEST} also replace the
+ * earlier ones for the same key that have not started, so only the latest of them runs.
+ */
+final class KeyedWorkQueue {
+    private static final String TAG = "ExtAssistant.Work";
+    private static final boolean DEBUG = Log.isLoggable(TAG, Log.DEBUG);
+
+    /** Always run the task. */
+    static final int POLICY_RUN = 0;
+    /** Drop the task if it waited longer than the maximum wait before starting. */
+    static final int POLICY_DROP_IF_STALE = 1;
+    /**
+     * Like {@link #POLICY_DROP_IF_STALE}, and replaces the tasks with this policy that are waiting
+     * for the same key.
+     */
+    static final int POLICY_LATEST = 2;
+
+    private static final class Task {
+        final Runnable runnable;
+        final int policy;
+        final long submittedMs;
+
+        Task(Runnable runnable, int policy, long submittedMs) {
+            this.runnable = runnable;
+            this.policy = policy;
+            this.submittedMs = submittedMs;
+        }
+    }
+
+    private final class Lane implements Runnable {
+        final String key;
+        final ArrayDeque<Task> tasks = new ArrayDeque<>();
+
+        Lane(String key) {
+            this.key = key;
+        }
+
+        @Override
+        public void run() {
+            runNext(this);
+        }
+    }
+
+    private final String mName;
+    private final int mCapacity;
+    private final long mMaxWaitMs;
+    // Uptime in milliseconds, for how long tasks wait.
+    private final LongSupplier mClock;
+    private final ExecutorService mExecutor;
+
+    private final Object mLock = new Object();
+    // Lanes with pending or running work; a lane is in the pool's queue or running while here.
+    @GuardedBy("mLock")
+    private final ArrayMap<String, Lane> mLanes = new ArrayMap<>();
+    @GuardedBy("mLock")
+    private boolean mShutdown;
+    // No longer accepting work, and waiting for the pending work to run.
+    @GuardedBy("mLock")
+    private boolean mDraining;
+    @GuardedBy("mLock")
+    private int mDepth;
+    @GuardedBy("mLock")
+    private int mMaxDepth;
+    @GuardedBy("mLock")
+    private long mSubmitted;
+    @GuardedBy("mLock")
+    private long mExecuted;
+    @GuardedBy("mLock")
+    private long mRejected;
+    @GuardedBy("mLock")
+    private long mDroppedStale;
+    @GuardedBy("mLock")
+    private long mSuperseded;
+    @GuardedBy("mLock")
+    private long mCancelled;
+    @GuardedBy("mLock")
+    private long mStarted;
+    @GuardedBy("mLock")
+    private long mTotalWaitMs;
+    @GuardedBy("mLock")
+    private long mLongestWaitMs;
+
+    /**
+     * @param threads the number of keys whose work can run at the same time
+     * @param capacity the maximum number of pending tasks
+     * @param maxWaitMs how long a {@link #POLICY_DROP_IF_STALE} task may wait before starting
+     */
+    KeyedWorkQueue(@NonNull String name, int threads, int capacity, long maxWaitMs) {
+        this(name, threads, capacity, maxWaitMs, SystemClock::uptimeMillis);
+    }
+
+    @VisibleForTesting
+    KeyedWorkQueue(@NonNull String name, int threads, int capacity, long maxWaitMs,
+            @NonNull LongSupplier clock) {
+        mName = name;
+        mCapacity = capacity;
+        mMaxWaitMs = maxWaitMs;
+        mClock = clock;
+        final AtomicInteger count = new AtomicInteger();
+        mExecutor = Executors.newFixedThreadPool(threads, runnable -> {
+            final Thread thread = new Thread(() -> {
+                Process.setThreadPriority(Process.THREAD_PRIORITY_BACKGROUND);
+                runnable.run();
+            }, name + "-" + count.incrementAndGet());
+            thread.setDaemon(true);
+            return thread;
+        });
+    }
+
+    /**
+     * Queues {@code task} behind any other work for {@code key}.
+     *
+     * @return false if the queue is full or shut down, and the task was rejected
+     */
+    boolean submit(@NonNull String key, int policy, @NonNull Runnable task) {
+        synchronized (mLock) {
+            if (mShutdown || mDraining) {
+                return false;
+            }
+            Lane lane = mLanes.get(key);
+            // Superseded tasks make room first, so that a full queue still takes the latest.
+            if (lane != null && policy == POLICY_LATEST) {
+                mSuperseded += removePendingLocked(lane, POLICY_LATEST);
+            }
+            if (mDepth >= mCapacity) {
+                mRejected++;
+                Log.w(TAG, mName + " is full, rejected work for " + key + " (" + mRejected
+                        + " rejected so far)");
+                return false;
+            }
+            final boolean idle = lane == null;
+            if (idle) {
+                lane = new Lane(key);
+                mLanes.put(key, lane);
+            }
+            lane.tasks.add(new Task(task, policy, mClock.getAsLong()));
+            mSubmitted++;
+            mDepth++;
+            mMaxDepth = Math.max(mMaxDepth, mDepth);
+            if (idle) {
+                mExecutor.execute(lane);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Removes the tasks with {@code policy} that are waiting for {@code key}. A task that has
+     * already started is not affected.
+     *
+     * @return the number of tasks removed
+     */
+    int cancel(@NonNull String key, int policy) {
+        synchronized (mLock) {
+            final Lane lane = mLanes.get(key);
+            if (lane == null) {
+                return 0;
+            }
+            final int removed = removePendingLocked(lane, policy);
+            mCancelled += removed;
+            return removed;
+        }
+    }
+
+    /**
+     * Whether a task with {@code policy} is waiting for {@code key}; a running task can use this
+     * to find out that its result is about to be superseded.
+     */
+    boolean hasPending(@NonNull String key, int policy) {
+        synchronized (mLock) {
+            final Lane lane = mLanes.get(key);
+            if (lane == null) {
+                return false;
+            }
+            for (Task task : lane.tasks) {
+                if (task.policy == policy) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
+    @GuardedBy("mLock")
+    private int removePendingLocked(Lane lane, int policy) {
+        int removed = 0;
+        for (Iterator<Task> it = lane.tasks.iterator(); it.hasNext(); ) {
+            if (it.next().policy == policy) {
+                it.remove();
+                removed++;
+            }
+        }
+        mDepth -= removed;
+        return removed;
+    }
+
+    /**
+     * Stops accepting work, waits up to {@code timeoutMs} for the tasks already submitted to
+     * run, and then shuts down like {@link #shutdown}.
+     *
+     * @return whether every task submitted had run
+     */
+    boolean drainAndShutdown(long timeoutMs) {
+        final boolean drained;
+        synchronized (mLock) {
+            mDraining = true;
+            final long deadline = SystemClock.uptimeMillis() + timeoutMs;
+            long remaining = timeoutMs;
+            while (!mShutdown && !mLanes.isEmpty() && remaining > 0) {
+                try {
+                    mLock.wait(remaining);
+                } catch (InterruptedException e) {
+                    Thread.currentThread().interrupt();
+                    break;
+                }
+                remaining = deadline - SystemClock.uptimeMillis();
+            }
+            drained = mLanes.isEmpty();
+        }
+        shutdown();
+        return drained;
+    }
+
+    /** Stops accepting work and discards the tasks that have not started yet. */
+    void shutdown() {
+        synchronized (mLock) {
+            mShutdown = true;
+            mLanes.clear();
+            mDepth = 0;
+        }
+        mExecutor.shutdown();
+    }
+
+    private void runNext(Lane lane) {
+        final Task task;
+        final long waitMs;
+        synchronized (mLock) {
+            if (mShutdown) {
+                return;
+            }
+            task = lane.tasks.poll();
+            if (task == null) {
+                // Everything queued for the key was cancelled before the lane got to run.
+                removeLaneLocked(lane);
+                return;
+            }
+            mDepth--;
+            mStarted++;
+            waitMs = mClock.getAsLong() - task.submittedMs;
+            mTotalWaitMs += waitMs;
+            mLongestWaitMs = Math.max(mLongestWaitMs, waitMs);
+        }
+        if (task.policy != POLICY_RUN && waitMs > mMaxWaitMs) {
+            if (DEBUG) Log.d(TAG, "Dropping stale work for " + lane.key + " after " + waitMs);
+            synchronized (mLock) {
+                mDroppedStale++;
+            }
+        } else {
+            try {
+                task.runnable.run();
+            } catch (Throwable e) {
+                Log.e(TAG, "Error running work for " + lane.key, e);
+            }
+            synchronized (mLock) {
+                mExecuted++;
+            }
+        }
+        synchronized (mLock) {
+            if (mShutdown) {
+                return;
+            }
+            if (lane.tasks.isEmpty()) {
+                removeLaneLocked(lane);
+            } else {
+                mExecutor.execute(lane);
+            }
+        }
+    }
+
+    @GuardedBy("mLock")
+    private void removeLaneLocked(Lane lane) {
+        mLanes.remove(lane.key);
+        if (mDraining && mLanes.isEmpty()) {
+            mLock.notifyAll();
+        }
+    }
+
+    /** Number of tasks waiting to run. */
+    int getDepth() {
+        synchronized (mLock) {
+            return mDepth;
+        }
+    }
+
+    int getMaxDepth() {
+        synchronized (mLock) {
+            return mMaxDepth;
+        }
+    }
+
+    long getSubmittedCount() {
+        synchronized (mLock) {
+            return mSubmitted;
+        }
+    }
+
+    long getExecutedCount() {
+        synchronized (mLock) {
+            return mExecuted;
+        }
+    }
+
+    long getRejectedCount() {
+        synchronized (mLock) {
+            return mRejected;
+        }
+    }
+
+    long getDroppedStaleCount() {
+        synchronized (mLock) {
+            return mDroppedStale;
+        }
+    }
+
+    /** Tasks replaced by a later {@link #POLICY_LATEST} task before they started. */
+    long getSupersededCount() {
+        synchronized (mLock) {
+            return mSuperseded;
+        }
+    }
+
+    long getCancelledCount() {
+        synchronized (mLock) {
+            return mCancelled;
+        }
+    }
+
+    /** Average time tasks waited before starting, in milliseconds. */
+    long getAverageWaitMs() {
+        synchronized (mLock) {
+            return mStarted == 0 ? 0 : mTotalWaitMs / mStarted;
+        }
+    }
+
+    long getLongestWaitMs() {
+        synchronized (mLock) {
+            return mLongestWaitMs;
+        }
+    }
+
+    @Override
+    public String toString() {
+        synchronized (mLock) {
+            return mName + "{depth=" + mDepth + ", maxDepth=" + mMaxDepth
+                    + ", submitted=" + mSubmitted + ", executed=" + mExecuted
+                    + ", rejected=" + mRejected + ", droppedStale=" + mDroppedStale
+                    + ", superseded=" + mSuperseded + ", cancelled=" + mCancelled
+                    + ", avgWaitMs=" + getAverageWaitMs() + ", longestWaitMs=" + mLongestWaitMs
+                    + "}";
+        }
+    }
+}
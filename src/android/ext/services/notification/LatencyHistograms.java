@@ -0,0 +1,227 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.os.SystemClock;
+import android.util.proto.ProtoOutputStream;
+
+import com.android.internal.annotations.GuardedBy;
+import com.android.internal.annotations.VisibleForTesting;
+
+import java.io.PrintWriter;
+import java.util.Arrays;
+
+/**
+ * Histograms of how long each stage of turning an enqueued notification into an adjustment
+ * takes.
+ *
+ * <p>Durations are bucketed log-linearly: four buckets for each power of two microseconds, so
+ * each bucket is at most a quarter wider than the ones before it. The histograms are kept for
+ * each of a ring of short windows, so that the dump shows recent latencies rather than ones
+ * averaged since boot. Recording is a few array writes under an uncontended lock.
+ */
+final class LatencyHistograms {
+    static final int STAGE_QUEUE_WAIT = 0;
+    static final int STAGE_BUILD_ENTRY = 1;
+    static final int STAGE_EXTRACT_MESSAGES = 2;
+    static final int STAGE_SUGGEST = 3;
+    static final int STAGE_BUILD_ACTIONS = 4;
+    // The adjustNotification call for an enqueued notification.
+    static final int STAGE_DELIVER = 5;
+    // From enqueue until the adjustment has been handed to the system.
+    static final int STAGE_TOTAL = 6;
+    static final int STAGE_COUNT = 7;
+
+    private static final String[] STAGE_NAMES = {
+            "queue_wait",
+            "build_entry",
+            "extract_messages",
+            "suggest",
+            "build_actions",
+            "deliver",
+            "total",
+    };
+
+    static String stageName(int stage) {
+        return STAGE_NAMES[stage];
+    }
+
+    private static final int SUB_BUCKET_BITS = 2;
+    private static final int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    // The last bucket holds everything over about two minutes.
+    @VisibleForTesting
+    static final int BUCKET_COUNT = 26 * SUB_BUCKETS;
+
+    private static final long DEFAULT_WINDOW_MS = 60 * 1000;
+    private static final int WINDOW_COUNT = 10;
+
+    private final long mWindowMs;
+
+    private final Object mLock = new Object();
+    // window slot : stage * BUCKET_COUNT + bucket : count
+    @GuardedBy("mLock")
+    private final long[][] mCounts = new long[WINDOW_COUNT][STAGE_COUNT * BUCKET_COUNT];
+    // window slot : number of the window it holds, or -1
+    @GuardedBy("mLock")
+    private final long[] mWindows = new long[WINDOW_COUNT];
+    @GuardedBy("mLock")
+    private final long[] mTotalCounts = new long[STAGE_COUNT];
+    @GuardedBy("mLock")
+    private final long[] mMaxMicros = new long[STAGE_COUNT];
+
+    LatencyHistograms() {
+        this(DEFAULT_WINDOW_MS);
+    }
+
+    @VisibleForTesting
+    LatencyHistograms(long windowMs) {
+        mWindowMs = windowMs;
+        for (int i = 0; i < WINDOW_COUNT; i++) {
+            mWindows[i] = -1;
+        }
+    }
+
+    /** Returns the time to pass to {@link #recordSince} once the stage is over. */
+    static long start() {
+        return SystemClock.elapsedRealtimeNanos();
+    }
+
+    /** Records a stage that started at {@code startNanos}, as returned by {@link #start}. */
+    void recordSince(int stage, long startNanos) {
+        record(stage, (SystemClock.elapsedRealtimeNanos() - startNanos) / 1000,
+                SystemClock.uptimeMillis());
+    }
+
+    @VisibleForTesting
+    void record(int stage, long micros, long nowMs) {
+        final int bucket = bucketOf(micros);
+        final long window = nowMs / mWindowMs;
+        final int slot = (int) (window % WINDOW_COUNT);
+        synchronized (mLock) {
+            if (mWindows[slot] < window) {
+                // The slot holds a window that has fallen out of the ring.
+                Arrays.fill(mCounts[slot], 0);
+                mWindows[slot] = window;
+            }
+            // A caller that raced past the end of its window only counts towards the totals.
+            if (mWindows[slot] == window) {
+                mCounts[slot][stage * BUCKET_COUNT + bucket]++;
+            }
+            mTotalCounts[stage]++;
+            mMaxMicros[stage] = Math.max(mMaxMicros[stage], micros);
+        }
+    }
+
+    @VisibleForTesting
+    static int bucketOf(long micros) {
+        if (micros < SUB_BUCKETS) {
+            return (int) Math.max(micros, 0);
+        }
+        final int log = 63 - Long.numberOfLeadingZeros(micros);
+        final int sub = (int) (micros >>> (log - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return Math.min((log - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub, BUCKET_COUNT - 1);
+    }
+
+    /** Returns the smallest duration, in microseconds, that falls into {@code bucket}. */
+    @VisibleForTesting
+    static long lowerBoundOf(int bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        final int log = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        final int sub = bucket % SUB_BUCKETS;
+        return (1L << log) + ((long) sub << (log - SUB_BUCKET_BITS));
+    }
+
+    /**
+     * Returns an upper bound, in microseconds, for the given percentile of the durations recorded
+     * in the windows of the ring that are still current, or -1 if there are none.
+     */
+    long getPercentileMicros(int stage, int percentile, long nowMs) {
+        synchronized (mLock) {
+            final long[] counts = recentCountsLocked(stage, nowMs);
+            long total = 0;
+            for (long count : counts) {
+                total += count;
+            }
+            if (total == 0) {
+                return -1;
+            }
+            final long rank = Math.max(1, (total * percentile + 99) / 100);
+            long seen = 0;
+            for (int bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+                seen += counts[bucket];
+                if (seen >= rank) {
+                    return bucket == BUCKET_COUNT - 1
+                            ? mMaxMicros[stage] : lowerBoundOf(bucket + 1) - 1;
+                }
+            }
+            return mMaxMicros[stage];
+        }
+    }
+
+    long getTotalCount(int stage) {
+        synchronized (mLock) {
+            return mTotalCounts[stage];
+        }
+    }
+
+    @GuardedBy("mLock")
+    private long[] recentCountsLocked(int stage, long nowMs) {
+        final long window = nowMs / mWindowMs;
+        final long[] counts = new long[BUCKET_COUNT];
+        for (int slot = 0; slot < WINDOW_COUNT; slot++) {
+            if (mWindows[slot] < 0 || window - mWindows[slot] >= WINDOW_COUNT) {
+                continue;
+            }
+            for (int bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+                counts[bucket] += mCounts[slot][stage * BUCKET_COUNT + bucket];
+            }
+        }
+        return counts;
+    }
+
+    /** Writes each stage as a repeated {@link AssistantDumpProto.StageLatency}. */
+    void writeToProto(ProtoOutputStream proto, long fieldId) {
+        final long nowMs = SystemClock.uptimeMillis();
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            final long token = proto.start(fieldId);
+            proto.write(AssistantDumpProto.StageLatency.STAGE, STAGE_NAMES[stage]);
+            proto.write(AssistantDumpProto.StageLatency.COUNT, getTotalCount(stage));
+            proto.write(AssistantDumpProto.StageLatency.P50_US,
+                    getPercentileMicros(stage, 50, nowMs));
+            proto.write(AssistantDumpProto.StageLatency.P90_US,
+                    getPercentileMicros(stage, 90, nowMs));
+            proto.write(AssistantDumpProto.StageLatency.P99_US,
+                    getPercentileMicros(stage, 99, nowMs));
+            proto.end(token);
+        }
+    }
+
+    void dump(PrintWriter pw, String prefix) {
+        final long nowMs = SystemClock.uptimeMillis();
+        pw.println(prefix + "latencies (us) over the last "
+                + (mWindowMs * WINDOW_COUNT / 1000) + "s:");
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            pw.println(prefix + "  " + STAGE_NAMES[stage]
+                    + ": p50=" + getPercentileMicros(stage, 50, nowMs)
+                    + " p90=" + getPercentileMicros(stage, 90, nowMs)
+                    + " p99=" + getPercentileMicros(stage, 99, nowMs)
+                    + " count=" + getTotalCount(stage));
+        }
+    }
+}
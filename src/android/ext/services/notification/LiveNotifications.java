@@ -0,0 +1,220 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.annotation.Nullable;
+import android.app.Notification;
+import android.os.Bundle;
+import android.os.Parcelable;
+
+import com.android.internal.annotations.GuardedBy;
+import com.android.internal.annotations.VisibleForTesting;
+
+import java.io.PrintWriter;
+import java.util.Collection;
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+
+/**
+ * The entries of the notifications that are showing, by SBN key.
+ *
+ * <p>Entries are put on the main thread and read from the worker threads. Each entry is charged
+ * an estimate of the memory it holds on to, and once the total goes over the cap the entries
+ * posted longest ago are dropped. A dropped entry only costs the suggestion events for its
+ * notification, which is preferable to holding on to an unbounded number of copies of large
+ * conversations.
+ */
+final class LiveNotifications {
+    // Rough sizes of the objects an entry holds, in bytes.
+    private static final int ENTRY_BYTES = 512;
+    private static final int ACTION_BYTES = 256;
+    private static final int PARCELABLE_BYTES = 128;
+    private static final int EXTRA_BYTES = 32;
+
+    private final Object mLock = new Object();
+    // SBN key : entry, least recently posted first.
+    @GuardedBy("mLock")
+    private final LinkedHashMap<String, Record> mEntries = new LinkedHashMap<>();
+    @GuardedBy("mLock")
+    private long mMaxBytes;
+    @GuardedBy("mLock")
+    private long mBytes;
+    @GuardedBy("mLock")
+    private long mPeakBytes;
+    @GuardedBy("mLock")
+    private long mEvictions;
+
+    private static final class Record {
+        final NotificationEntry entry;
+        final int bytes;
+
+        Record(NotificationEntry entry, int bytes) {
+            this.entry = entry;
+            this.bytes = bytes;
+        }
+    }
+
+    LiveNotifications(long maxBytes) {
+        mMaxBytes = maxBytes;
+    }
+
+    /**
+     * Adds or replaces the entry for its notification. The entry just put is never dropped, even
+     * if it is over the cap on its own.
+     */
+    void put(@NonNull NotificationEntry entry) {
+        final String key = entry.getSbn().getKey();
+        final Record record = new Record(entry, estimateBytes(entry));
+        synchronized (mLock) {
+            final Record previous = mEntries.remove(key);
+            if (previous != null) {
+                mBytes -= previous.bytes;
+            }
+            mEntries.put(key, record);
+            mBytes += record.bytes;
+            mPeakBytes = Math.max(mPeakBytes, mBytes);
+            trimLocked();
+        }
+    }
+
+    @Nullable
+    NotificationEntry get(@NonNull String key) {
+        synchronized (mLock) {
+            final Record record = mEntries.get(key);
+            return record == null ? null : record.entry;
+        }
+    }
+
+    /** Returns the entry that was removed, or null if there was none. */
+    @Nullable
+    NotificationEntry remove(@NonNull String key) {
+        synchronized (mLock) {
+            final Record record = mEntries.remove(key);
+            if (record == null) {
+                return null;
+            }
+            mBytes -= record.bytes;
+            return record.entry;
+        }
+    }
+
+    boolean containsKey(@NonNull String key) {
+        synchronized (mLock) {
+            return mEntries.containsKey(key);
+        }
+    }
+
+    void clear() {
+        synchronized (mLock) {
+            mEntries.clear();
+            mBytes = 0;
+        }
+    }
+
+    void setMaxBytes(long maxBytes) {
+        synchronized (mLock) {
+            mMaxBytes = maxBytes;
+            trimLocked();
+        }
+    }
+
+    @GuardedBy("mLock")
+    private void trimLocked() {
+        final Iterator<Record> oldest = mEntries.values().iterator();
+        while (mBytes > mMaxBytes && mEntries.size() > 1) {
+            mBytes -= oldest.next().bytes;
+            oldest.remove();
+            mEvictions++;
+        }
+    }
+
+    int size() {
+        synchronized (mLock) {
+            return mEntries.size();
+        }
+    }
+
+    /** Estimated memory held by the entries, in bytes. */
+    long getBytes() {
+        synchronized (mLock) {
+            return mBytes;
+        }
+    }
+
+    long getMaxBytes() {
+        synchronized (mLock) {
+            return mMaxBytes;
+        }
+    }
+
+    long getPeakBytes() {
+        synchronized (mLock) {
+            return mPeakBytes;
+        }
+    }
+
+    long getEvictionCount() {
+        synchronized (mLock) {
+            return mEvictions;
+        }
+    }
+
+    void dump(PrintWriter pw, String prefix) {
+        synchronized (mLock) {
+            pw.println(prefix + "live notifications: " + mEntries.size()
+                    + ", bytes=" + mBytes + "/" + mMaxBytes
+                    + ", peakBytes=" + mPeakBytes
+                    + ", evictions=" + mEvictions);
+        }
+    }
+
+    /**
+     * Estimates the memory held by an entry from the light copy of its notification: the text
+     * in its extras, the parcelables kept for conversations and people, and its actions.
+     */
+    @VisibleForTesting
+    static int estimateBytes(@NonNull NotificationEntry entry) {
+        final Notification notification = entry.getNotification();
+        int bytes = ENTRY_BYTES + 2 * entry.getSbn().getKey().length();
+        if (notification.actions != null) {
+            bytes += notification.actions.length * ACTION_BYTES;
+        }
+        final Bundle extras = notification.extras;
+        if (extras == null) {
+            return bytes;
+        }
+        for (String key : extras.keySet()) {
+            final Object value = extras.get(key);
+            bytes += EXTRA_BYTES;
+            if (value instanceof CharSequence) {
+                bytes += 2 * ((CharSequence) value).length();
+            } else if (value instanceof CharSequence[]) {
+                for (CharSequence line : (CharSequence[]) value) {
+                    bytes += line == null ? 0 : 2 * line.length();
+                }
+            } else if (value instanceof Parcelable[]) {
+                bytes += ((Parcelable[]) value).length * PARCELABLE_BYTES;
+            } else if (value instanceof Collection) {
+                bytes += ((Collection<?>) value).size() * PARCELABLE_BYTES;
+            } else if (value instanceof Parcelable) {
+                bytes += PARCELABLE_BYTES;
+            }
+        }
+        return bytes;
+    }
+}
@@ -0,0 +1,169 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.annotation.Nullable;
+import android.app.Notification;
+import android.app.Person;
+import android.text.TextUtils;
+import android.view.textclassifier.ConversationActions;
+
+import com.android.internal.annotations.GuardedBy;
+
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.List;
+import java.util.Objects;
+
+/**
+ * The messages last extracted from each conversation, by SBN key.
+ *
+ * <p>A conversation is re-posted with all of its messages each time one is added. The messages
+ * of the previous window are recognized in the new post by their time, text and sender, so that
+ * only the messages added since are converted for the text classifier, and the messages of the
+ * previous post are passed on as the same objects. Windows are dropped when their notification
+ * is removed, or least recently used first once the cache is full.
+ */
+final class MessageWindowCache {
+    private final int mCapacity;
+
+    private final Object mLock = new Object();
+    // SBN key : window, least recently used first
+    @GuardedBy("mLock")
+    private final LinkedHashMap<String, Window> mWindows =
+            new LinkedHashMap<>(16, 0.75f, /* accessOrder */ true);
+    @GuardedBy("mLock")
+    private long mReused;
+    @GuardedBy("mLock")
+    private long mConverted;
+
+    /** A message as posted, with what it was extracted as. */
+    static final class Item {
+        final long time;
+        @Nullable
+        final CharSequence text;
+        // Null if the message is from the local user.
+        @Nullable
+        final Person sender;
+        final ConversationActions.Message message;
+
+        Item(@NonNull Notification.MessagingStyle.Message posted,
+                @NonNull ConversationActions.Message message) {
+            this.time = posted.getTimestamp();
+            this.text = posted.getText();
+            this.sender = posted.getSenderPerson();
+            this.message = message;
+        }
+
+        boolean matches(@NonNull Notification.MessagingStyle.Message posted) {
+            return time == posted.getTimestamp()
+                    && TextUtils.equals(text, posted.getText())
+                    && isSamePerson(sender, posted.getSenderPerson());
+        }
+    }
+
+    /** The messages extracted from one post of a conversation, newest first. */
+    static final class Window {
+        // Messages are extracted relative to the local user, so a window is only valid for it.
+        @Nullable
+        final Person localUser;
+        final List<Item> items;
+
+        Window(@Nullable Person localUser, @NonNull List<Item> items) {
+            this.localUser = localUser;
+            this.items = items;
+        }
+
+        @Nullable
+        Item find(@NonNull Notification.MessagingStyle.Message posted) {
+            for (int i = 0; i < items.size(); i++) {
+                final Item item = items.get(i);
+                if (item.matches(posted)) {
+                    return item;
+                }
+            }
+            return null;
+        }
+    }
+
+    MessageWindowCache(int capacity) {
+        mCapacity = capacity;
+    }
+
+    @Nullable
+    Window get(@NonNull String key) {
+        synchronized (mLock) {
+            return mWindows.get(key);
+        }
+    }
+
+    /**
+     * Stores the window last extracted for {@code key}, of which {@code converted} messages had
+     * to be converted and {@code reused} were taken from the previous window.
+     */
+    void put(@NonNull String key, @NonNull Window window, int converted, int reused) {
+        synchronized (mLock) {
+            mConverted += converted;
+            mReused += reused;
+            mWindows.put(key, window);
+            if (mWindows.size() > mCapacity) {
+                final Iterator<Window> eldest = mWindows.values().iterator();
+                eldest.next();
+                eldest.remove();
+            }
+        }
+    }
+
+    void remove(@NonNull String key) {
+        synchronized (mLock) {
+            mWindows.remove(key);
+        }
+    }
+
+    int size() {
+        synchronized (mLock) {
+            return mWindows.size();
+        }
+    }
+
+    /** Number of messages taken from a previous window instead of converted. */
+    long getReusedCount() {
+        synchronized (mLock) {
+            return mReused;
+        }
+    }
+
+    long getConvertedCount() {
+        synchronized (mLock) {
+            return mConverted;
+        }
+    }
+
+    /**
+     * Returns whether two senders are the same person. Names alone are not enough, since two
+     * participants may go by the same name.
+     */
+    static boolean isSamePerson(@Nullable Person left, @Nullable Person right) {
+        if (left == null || right == null) {
+            return left == right;
+        }
+        return Objects.equals(left.getKey(), right.getKey())
+                && TextUtils.equals(left.getName(), right.getName())
+                && Objects.equals(left.getUri(), right.getUri());
+    }
+}
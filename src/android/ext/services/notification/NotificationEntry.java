@@ -29,22 +29,18 @@ import android.app.Person;
 import android.app.RemoteInput;
 import android.content.ComponentName;
 import android.content.Context;
-import android.content.pm.ApplicationInfo;
 import android.content.pm.IPackageManager;
-import android.content.pm.PackageManager;
-import android.graphics.drawable.Icon;
 import android.media.AudioAttributes;
 import android.media.AudioSystem;
 import android.os.Build;
+import android.os.Bundle;
 import android.os.Parcelable;
-import android.os.RemoteException;
 import android.service.notification.StatusBarNotification;
 import android.util.Log;
-import android.util.SparseArray;
 
 import java.util.ArrayList;
 import java.util.Objects;
-import java.util.Set;
+import java.util.concurrent.atomic.AtomicIntegerFieldUpdater;
 
 /**
  * Holds data about notifications.
@@ -55,74 +51,85 @@ public class NotificationEntry {
     // Copied from hidden definitions in Notification.TvExtender
     private static final String EXTRA_TV_EXTENDER = "android.tv.EXTENSIONS";
 
-    private final Context mContext;
+    // Facts about the notification that do not change over the life of the entry.
+    private static final int FACT_MESSAGING = 1 << 0;
+    private static final int FACT_INBOX_STYLE = 1 << 1;
+    private static final int FACT_HAS_PERSON = 1 << 2;
+    private static final int FACT_INLINE_REPLY = 1 << 3;
+    private static final int FACT_ONGOING = 1 << 4;
+
+    // Bits of mState.
+    private static final int STATE_SEEN = 1 << 0;
+    private static final int STATE_SHOW_ACTION_EVENT_LOGGED = 1 << 1;
+
+    private static final AtomicIntegerFieldUpdater<NotificationEntry> STATE_UPDATER =
+            AtomicIntegerFieldUpdater.newUpdater(NotificationEntry.class, "mState");
+
     private final StatusBarNotification mSbn;
-    private final IPackageManager mPackageManager;
     private int mTargetSdkVersion = Build.VERSION_CODES.N_MR1;
     private final boolean mPreChannelsNotification;
     private final AudioAttributes mAttributes;
     private final NotificationChannel mChannel;
     private final int mImportance;
-    private boolean mSeen;
-    private boolean mIsShowActionEventLogged;
+    private final Class<? extends Notification.Style> mStyle;
+    private final int mFacts;
+    // Set from the binder and worker threads, and only ever set, never cleared.
+    private volatile int mState;
     private final SmsHelper mSmsHelper;
 
-    private final Object mLock = new Object();
-
     public NotificationEntry(Context applicationContext, IPackageManager packageManager,
             StatusBarNotification sbn, NotificationChannel channel, SmsHelper smsHelper) {
-        mContext = applicationContext;
+        this(applicationContext, new TargetSdkCache(packageManager), sbn, channel, smsHelper);
+    }
+
+    NotificationEntry(Context applicationContext, TargetSdkCache targetSdkCache,
+            StatusBarNotification sbn, NotificationChannel channel, SmsHelper smsHelper) {
         mSbn = cloneStatusBarNotificationLight(sbn);
         mChannel = channel;
-        mPackageManager = packageManager;
-        mPreChannelsNotification = isPreChannelsNotification();
+        mPreChannelsNotification = isPreChannelsNotification(targetSdkCache);
         mAttributes = calculateAudioAttributes();
         mImportance = calculateInitialImportance();
+        mStyle = getNotification().getNotificationStyle();
+        mFacts = calculateFacts();
         mSmsHelper = smsHelper;
     }
 
-    /** Adapted from {@code Notification.lightenPayload}. */
-    @SuppressWarnings("nullness")
-    private static void lightenNotificationPayload(Notification notification) {
-        notification.tickerView = null;
-        notification.contentView = null;
-        notification.bigContentView = null;
-        notification.headsUpContentView = null;
-        notification.largeIcon = null;
-        if (notification.extras != null && !notification.extras.isEmpty()) {
-            final Set<String> keyset = notification.extras.keySet();
-            final int keysetSize = keyset.size();
-            final String[] keys = keyset.toArray(new String[keysetSize]);
-            for (int i = 0; i < keysetSize; i++) {
-                final String key = keys[i];
-                if (EXTRA_TV_EXTENDER.equals(key)
-                        || Notification.EXTRA_MESSAGES.equals(key)
-                        || Notification.EXTRA_MESSAGING_PERSON.equals(key)
-                        || Notification.EXTRA_PEOPLE_LIST.equals(key)) {
-                    continue;
-                }
-                final Object obj = notification.extras.get(key);
-                if (obj != null
-                        && (obj instanceof Parcelable
-                        || obj instanceof Parcelable[]
-                        || obj instanceof SparseArray
-                        || obj instanceof ArrayList)) {
-                    notification.extras.remove(key);
-                }
+    // Extras that the assistant reads, kept although they hold parcelables.
+    private static final String[] KEPT_HEAVY_EXTRAS = {
+            EXTRA_TV_EXTENDER,
+            Notification.EXTRA_MESSAGES,
+            Notification.EXTRA_MESSAGING_PERSON,
+            Notification.EXTRA_PEOPLE_LIST,
+    };
+
+    /**
+     * Returns a light copy of {@code notification}, without its views, icons and the extras the
+     * assistant does not read.
+     *
+     * <p>The fields are copied by reference rather than by recovering a builder and building a
+     * new notification, which also restores the style and regenerates all the extras.
+     */
+    @SuppressWarnings("unchecked")
+    private static Notification cloneNotificationLight(Notification notification) {
+        final Notification lightNotification = new Notification();
+        // This leaves out the views and the large icon, and strips every parcelable extra.
+        notification.cloneInto(lightNotification, false /* heavy */);
+        lightNotification.setSmallIcon(null);
+        final Bundle extras = notification.extras;
+        if (extras == null || extras.isEmpty()) {
+            return lightNotification;
+        }
+        for (String key : KEPT_HEAVY_EXTRAS) {
+            final Object value = extras.get(key);
+            if (value instanceof Parcelable) {
+                lightNotification.extras.putParcelable(key, (Parcelable) value);
+            } else if (value instanceof Parcelable[]) {
+                lightNotification.extras.putParcelableArray(key, (Parcelable[]) value);
+            } else if (value instanceof ArrayList) {
+                lightNotification.extras.putParcelableArrayList(
+                        key, (ArrayList<? extends Parcelable>) value);
             }
         }
-    }
-
-    /** An interpretation of {@code Notification.cloneInto} with heavy=false. */
-    private Notification cloneNotificationLight(Notification notification) {
-        // We can't just use clone() here because the only way to remove the icons is with the
-        // builder, which we can only create with a Context.
-        Notification lightNotification =
-                Notification.Builder.recoverBuilder(mContext, notification)
-                        .setSmallIcon(0)
-                        .setLargeIcon((Icon) null)
-                        .build();
-        lightenNotificationPayload(lightNotification);
         return lightNotification;
     }
 
@@ -141,16 +148,11 @@ public class NotificationEntry {
                 sbn.getPostTime());
     }
 
-    private boolean isPreChannelsNotification() {
-        try {
-            ApplicationInfo info = mPackageManager.getApplicationInfo(
-                    mSbn.getPackageName(), PackageManager.MATCH_ALL,
-                    mSbn.getUserId());
-            if (info != null) {
-                mTargetSdkVersion = info.targetSdkVersion;
-            }
-        } catch (RemoteException e) {
-            Log.w(TAG, "Couldn't look up " + mSbn.getPackageName());
+    private boolean isPreChannelsNotification(TargetSdkCache targetSdkCache) {
+        final int targetSdk =
+                targetSdkCache.getTargetSdk(mSbn.getPackageName(), mSbn.getUserId());
+        if (targetSdk != TargetSdkCache.UNKNOWN) {
+            mTargetSdkVersion = targetSdk;
         }
         if (NotificationChannel.DEFAULT_CHANNEL_ID.equals(getChannel().getId())) {
             if (mTargetSdkVersion < Build.VERSION_CODES.O) {
@@ -247,29 +249,77 @@ public class NotificationEntry {
         return mAttributes != null && mAttributes.getUsage() == usage;
     }
 
-    private boolean hasPerson() {
+    /**
+     * Works out the facts that categorization asks for repeatedly, so that answering them does
+     * not walk the extras and actions each time. The light copy of the notification is not
+     * changed after construction, so they stay valid.
+     */
+    private int calculateFacts() {
+        int facts = 0;
+        if (isCategory(CATEGORY_MESSAGE)
+                || isPublicVersionCategory(CATEGORY_MESSAGE)
+                || Notification.MessagingStyle.class.equals(mStyle)) {
+            facts |= FACT_MESSAGING;
+        }
+        if (Notification.InboxStyle.class.equals(mStyle)) {
+            facts |= FACT_INBOX_STYLE;
+        }
+        if (calculateHasPerson()) {
+            facts |= FACT_HAS_PERSON;
+        }
+        if (calculateHasInlineReply()) {
+            facts |= FACT_INLINE_REPLY;
+        }
+        if ((getNotification().flags & Notification.FLAG_FOREGROUND_SERVICE) != 0) {
+            facts |= FACT_ONGOING;
+        }
+        return facts;
+    }
+
+    private boolean hasFact(int fact) {
+        return (mFacts & fact) != 0;
+    }
+
+    private boolean calculateHasPerson() {
         // TODO: cache favorite and recent contacts to check contact affinity
         ArrayList<Person> people = getNotification().extras.getParcelableArrayList(
                 Notification.EXTRA_PEOPLE_LIST);
         return people != null && !people.isEmpty();
     }
 
+    private boolean calculateHasInlineReply() {
+        Notification.Action[] actions = getNotification().actions;
+        if (actions == null) {
+            return false;
+        }
+        for (Notification.Action action : actions) {
+            RemoteInput[] remoteInputs = action.getRemoteInputs();
+            if (remoteInputs == null) {
+                continue;
+            }
+            for (RemoteInput remoteInput : remoteInputs) {
+                if (remoteInput.getAllowFreeFormInput()) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
     protected boolean hasStyle(Class targetStyle) {
-        Class<? extends Notification.Style> style = getNotification().getNotificationStyle();
-        return targetStyle.equals(style);
+        return targetStyle.equals(mStyle);
     }
 
     protected boolean isOngoing() {
-        return (getNotification().flags & Notification.FLAG_FOREGROUND_SERVICE) != 0;
+        return hasFact(FACT_ONGOING);
     }
 
     protected boolean involvesPeople() {
-        return isMessaging()
-                || hasStyle(Notification.InboxStyle.class)
-                || hasPerson()
+        return hasFact(FACT_MESSAGING | FACT_INBOX_STYLE | FACT_HAS_PERSON)
                 || isDefaultSmsApp();
     }
 
+    // Not memoized, since the default SMS app can change while the notification is showing.
     private boolean isDefaultSmsApp() {
         ComponentName defaultSmsApp = mSmsHelper.getDefaultSmsApplication();
         if (defaultSmsApp == null) {
@@ -279,52 +329,44 @@ public class NotificationEntry {
     }
 
     protected boolean isMessaging() {
-        return isCategory(CATEGORY_MESSAGE)
-                || isPublicVersionCategory(CATEGORY_MESSAGE)
-                || hasStyle(Notification.MessagingStyle.class);
+        return hasFact(FACT_MESSAGING);
     }
 
     public boolean hasInlineReply() {
-        Notification.Action[] actions = getNotification().actions;
-        if (actions == null) {
-            return false;
-        }
-        for (Notification.Action action : actions) {
-            RemoteInput[] remoteInputs = action.getRemoteInputs();
-            if (remoteInputs == null) {
-                continue;
-            }
-            for (RemoteInput remoteInput : remoteInputs) {
-                if (remoteInput.getAllowFreeFormInput()) {
-                    return true;
-                }
-            }
-        }
-        return false;
+        return hasFact(FACT_INLINE_REPLY);
     }
 
     public void setSeen() {
-        synchronized (mLock) {
-            mSeen = true;
-        }
+        setState(STATE_SEEN);
     }
 
-    public void setShowActionEventLogged() {
-        synchronized (mLock) {
-            mIsShowActionEventLogged = true;
-        }
+    /**
+     * Marks the show action event as logged.
+     *
+     * @return true if this call marked it, false if it was already logged
+     */
+    public boolean setShowActionEventLogged() {
+        return setState(STATE_SHOW_ACTION_EVENT_LOGGED);
     }
 
     public boolean hasSeen() {
-        synchronized (mLock) {
-            return mSeen;
-        }
+        return (mState & STATE_SEEN) != 0;
     }
 
     public boolean isShowActionEventLogged() {
-        synchronized (mLock) {
-            return mIsShowActionEventLogged;
-        }
+        return (mState & STATE_SHOW_ACTION_EVENT_LOGGED) != 0;
+    }
+
+    // Returns whether this call set the bit.
+    private boolean setState(int bit) {
+        int state;
+        do {
+            state = mState;
+            if ((state & bit) != 0) {
+                return false;
+            }
+        } while (!STATE_UPDATER.compareAndSet(this, state, state | bit));
+        return true;
     }
 
     public StatusBarNotification getSbn() {
@@ -0,0 +1,123 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.annotation.Nullable;
+import android.app.NotificationChannel;
+import android.service.notification.StatusBarNotification;
+
+import com.android.internal.annotations.GuardedBy;
+
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.Objects;
+
+/**
+ * Hands the entry built for an enqueued notification over to the post of the same notification,
+ * so that it is not built twice.
+ *
+ * <p>An entry is only handed over if it was built for the same version of the notification,
+ * going by its post time, and for an equal channel; otherwise the caller builds a new one. Each
+ * entry is handed over at most once. The cache holds a bounded number of entries, dropping the
+ * oldest first, since a notification can be enqueued and then never posted.
+ */
+final class NotificationEntryCache {
+    private final int mCapacity;
+
+    private final Object mLock = new Object();
+    // SBN key : entry, oldest first.
+    @GuardedBy("mLock")
+    private final LinkedHashMap<String, NotificationEntry> mEntries = new LinkedHashMap<>();
+    @GuardedBy("mLock")
+    private long mHits;
+    @GuardedBy("mLock")
+    private long mMisses;
+    @GuardedBy("mLock")
+    private long mEvictions;
+
+    NotificationEntryCache(int capacity) {
+        mCapacity = capacity;
+    }
+
+    /** Offers the entry built for an enqueued notification. */
+    void put(@NonNull NotificationEntry entry) {
+        final String key = entry.getSbn().getKey();
+        synchronized (mLock) {
+            mEntries.remove(key);
+            if (mEntries.size() >= mCapacity) {
+                final Iterator<NotificationEntry> oldest = mEntries.values().iterator();
+                oldest.next();
+                oldest.remove();
+                mEvictions++;
+            }
+            mEntries.put(key, entry);
+        }
+    }
+
+    /**
+     * Returns the entry built for this version of the notification on this channel, or null if
+     * there is none and the caller has to build it.
+     */
+    @Nullable
+    NotificationEntry take(@NonNull StatusBarNotification sbn,
+            @NonNull NotificationChannel channel) {
+        final NotificationEntry entry;
+        synchronized (mLock) {
+            entry = mEntries.remove(sbn.getKey());
+            if (entry == null || entry.getSbn().getPostTime() != sbn.getPostTime()
+                    || !Objects.equals(entry.getChannel(), channel)) {
+                mMisses++;
+                return null;
+            }
+            mHits++;
+        }
+        return entry;
+    }
+
+    /** Forgets the entry for a notification that was removed. */
+    void remove(@NonNull String key) {
+        synchronized (mLock) {
+            mEntries.remove(key);
+        }
+    }
+
+    void clear() {
+        synchronized (mLock) {
+            mEntries.clear();
+        }
+    }
+
+    /** Number of posts that reused the entry built when the notification was enqueued. */
+    long getHitCount() {
+        synchronized (mLock) {
+            return mHits;
+        }
+    }
+
+    long getMissCount() {
+        synchronized (mLock) {
+            return mMisses;
+        }
+    }
+
+    long getEvictionCount() {
+        synchronized (mLock) {
+            return mEvictions;
+        }
+    }
+}
@@ -0,0 +1,213 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.annotation.Nullable;
+import android.text.TextUtils;
+import android.util.ArrayMap;
+
+import com.android.internal.annotations.GuardedBy;
+import com.android.internal.annotations.VisibleForTesting;
+
+import java.util.Iterator;
+import java.util.LinkedHashMap;
+import java.util.function.IntSupplier;
+
+/**
+ * The logging sessions of the suggestions made for each notification, by SBN key.
+ *
+ * <p>A session lives as long as its notification: it ends when the notification is removed or
+ * gets new suggestions. The store is only trimmed, oldest session first, if it grows past the
+ * number of notifications showing, which happens when removals were missed; those evictions are
+ * counted, since each one may lose the events of suggestions the user could still see.
+ *
+ * <p>Suggestions are worked out while other threads handle removals and events, so a session
+ * is only stored if its notification was not removed in the meantime, and a removal only ends
+ * the session the notification had when it was removed, not that of a re-post.
+ */
+final class SessionStore {
+    @VisibleForTesting
+    static final int MIN_CAPACITY = 20;
+
+    private final IntSupplier mLiveNotificationCount;
+
+    private final Object mLock = new Object();
+    // SBN key : session, oldest first
+    @GuardedBy("mLock")
+    private final LinkedHashMap<String, Session> mSessions = new LinkedHashMap<>();
+    // SBN key : token of the suggestions being worked out, until they are stored or abandoned
+    @GuardedBy("mLock")
+    private final ArrayMap<String, Object> mSuggesting = new ArrayMap<>();
+    @GuardedBy("mLock")
+    private long mHits;
+    @GuardedBy("mLock")
+    private long mMisses;
+    @GuardedBy("mLock")
+    private long mEvictions;
+
+    /** The suggestions made for a notification, as reported to the text classifier. */
+    static final class Session {
+        final String resultId;
+        // The suggested replies and their scores, at the same index.
+        private final CharSequence[] mReplies;
+        private final float[] mScores;
+
+        Session(@NonNull String resultId, @NonNull CharSequence[] replies,
+                @NonNull float[] scores) {
+            this.resultId = resultId;
+            mReplies = replies;
+            mScores = scores;
+        }
+
+        /** Returns the score of a suggested reply, or 0 if it was not suggested. */
+        float getReplyScore(@Nullable CharSequence reply) {
+            for (int i = 0; i < mReplies.length; i++) {
+                if (TextUtils.equals(mReplies[i], reply)) {
+                    return mScores[i];
+                }
+            }
+            return 0f;
+        }
+    }
+
+    /**
+     * @param liveNotificationCount the number of notifications showing, which the store may grow
+     *                              to before evicting sessions
+     */
+    SessionStore(@NonNull IntSupplier liveNotificationCount) {
+        mLiveNotificationCount = liveNotificationCount;
+    }
+
+    @Nullable
+    Session get(@NonNull String key) {
+        synchronized (mLock) {
+            final Session session = mSessions.get(key);
+            if (session == null) {
+                mMisses++;
+            } else {
+                mHits++;
+            }
+            return session;
+        }
+    }
+
+    /**
+     * Ends the session of a notification that is getting new suggestions.
+     *
+     * @return the token to store the session of the new suggestions with
+     */
+    @NonNull
+    Object startSuggesting(@NonNull String key) {
+        final Object token = new Object();
+        synchronized (mLock) {
+            mSessions.remove(key);
+            mSuggesting.put(key, token);
+        }
+        return token;
+    }
+
+    /**
+     * Stores the session of the suggestions started with {@code token}, unless the notification
+     * was removed or got newer suggestions since.
+     *
+     * @param session the session, or null if the suggestions need none
+     */
+    void finishSuggesting(@NonNull String key, @NonNull Object token, @Nullable Session session) {
+        final int capacity = getCapacity();
+        synchronized (mLock) {
+            if (mSuggesting.get(key) != token) {
+                return;
+            }
+            mSuggesting.remove(key);
+            if (session != null) {
+                putLocked(key, session, capacity);
+            }
+        }
+    }
+
+    /**
+     * Abandons the suggestions being worked out for a notification that was removed.
+     *
+     * @return the session to end once the events already made for the notification are logged
+     */
+    @Nullable
+    Session onNotificationRemoved(@NonNull String key) {
+        synchronized (mLock) {
+            mSuggesting.remove(key);
+            return mSessions.get(key);
+        }
+    }
+
+    @VisibleForTesting
+    void put(@NonNull String key, @NonNull Session session) {
+        final int capacity = getCapacity();
+        synchronized (mLock) {
+            putLocked(key, session, capacity);
+        }
+    }
+
+    private int getCapacity() {
+        return Math.max(MIN_CAPACITY, mLiveNotificationCount.getAsInt());
+    }
+
+    @GuardedBy("mLock")
+    private void putLocked(String key, Session session, int capacity) {
+        mSessions.remove(key);
+        mSessions.put(key, session);
+        final Iterator<Session> oldest = mSessions.values().iterator();
+        while (mSessions.size() > capacity) {
+            oldest.next();
+            oldest.remove();
+            mEvictions++;
+        }
+    }
+
+    /** Ends {@code session}, if it is still the session of the notification. */
+    void remove(@NonNull String key, @NonNull Session session) {
+        synchronized (mLock) {
+            if (mSessions.get(key) == session) {
+                mSessions.remove(key);
+            }
+        }
+    }
+
+    int size() {
+        synchronized (mLock) {
+            return mSessions.size();
+        }
+    }
+
+    long getHitCount() {
+        synchronized (mLock) {
+            return mHits;
+        }
+    }
+
+    long getMissCount() {
+        synchronized (mLock) {
+            return mMisses;
+        }
+    }
+
+    /** Number of sessions dropped while their notification may still have been showing. */
+    long getEvictionCount() {
+        synchronized (mLock) {
+            return mEvictions;
+        }
+    }
+}
@@ -28,10 +28,10 @@ import android.graphics.drawable.Icon;
 import android.os.Bundle;
 import android.os.Parcelable;
 import android.os.Process;
+import android.os.SystemClock;
 import android.service.notification.NotificationAssistantService;
 import android.text.TextUtils;
-import android.util.ArrayMap;
-import android.util.LruCache;
+import android.util.Log;
 import android.util.Pair;
 import android.view.textclassifier.ConversationAction;
 import android.view.textclassifier.ConversationActions;
@@ -47,18 +47,30 @@ import java.time.ZoneOffset;
 import java.time.ZonedDateTime;
 import java.util.ArrayDeque;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.Collections;
 import java.util.Deque;
 import java.util.List;
-import java.util.Map;
 import java.util.Objects;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.Future;
+import java.util.concurrent.LinkedBlockingQueue;
+import java.util.concurrent.RejectedExecutionException;
+import java.util.concurrent.ThreadPoolExecutor;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.TimeoutException;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.function.IntSupplier;
 
 /**
  * Generates suggestions from incoming notifications.
  *
- * Methods in this class should be called in a single worker thread.
+ * Suggestions are computed on the work queue of {@link Assistant}, and suggestion events are
+ * logged on its event queue. The text classifier is called on a thread of its own, so that a
+ * slow classifier only costs the suggestions that missed their deadline.
  */
 public class SmartActionsHelper {
+    private static final String TAG = "SmartActionsHelper";
     static final String ENTITIES_EXTRAS = "entities-extras";
     static final String KEY_ACTION_TYPE = "action_type";
     static final String KEY_ACTION_SCORE = "action_score";
@@ -69,7 +81,15 @@ public class SmartActionsHelper {
                     | Notification.FLAG_FOREGROUND_SERVICE
                     | Notification.FLAG_GROUP_SUMMARY
                     | Notification.FLAG_NO_CLEAR;
-    private static final int MAX_RESULT_ID_TO_CACHE = 20;
+    private static final int MAX_RESULTS_TO_CACHE = 32;
+    // Suggestions for a conversation are reused for re-posts with the same messages for this
+    // long.
+    private static final long RESULT_CACHE_TTL_MS = 5 * 60 * 1000;
+    // Calls to the classifier waiting for the inference thread. Beyond this the classifier is
+    // behind anyway, and the suggestion is given up on right away.
+    private static final int MAX_PENDING_INFERENCES = 8;
+    private static final long INFERENCE_THREAD_KEEP_ALIVE_MS = 30_000;
+    private static final int MAX_MESSAGE_WINDOWS_TO_CACHE = 64;
 
     private static final List<String> HINTS =
             Collections.singletonList(ConversationActions.Request.HINT_FOR_NOTIFICATION);
@@ -79,17 +99,91 @@ public class SmartActionsHelper {
     private Context mContext;
     private TextClassificationManager mTextClassificationManager;
     private AssistantSettings mSettings;
-    private LruCache<String, Session> mSessionCache = new LruCache<>(MAX_RESULT_ID_TO_CACHE);
+    private final SessionStore mSessions;
+    private final LatencyHistograms mLatencies;
+    private final ConversationActionsCache mResultCache =
+            new ConversationActionsCache(MAX_RESULTS_TO_CACHE, RESULT_CACHE_TTL_MS);
+    private final ThreadPoolExecutor mInferenceExecutor;
+    // Every event is about this package's notifications.
+    private final TextClassificationContext mEventContext;
+    private final AtomicLong mSuggestTimeouts = new AtomicLong();
+    private final MessageWindowCache mMessageWindows =
+            new MessageWindowCache(MAX_MESSAGE_WINDOWS_TO_CACHE);
 
     SmartActionsHelper(Context context, AssistantSettings settings) {
+        this(context, settings, new LatencyHistograms(), () -> 0);
+    }
+
+    /**
+     * @param liveNotificationCount the number of notifications showing, which bounds the number
+     *                              of suggestion sessions kept
+     */
+    SmartActionsHelper(Context context, AssistantSettings settings,
+            LatencyHistograms latencies, IntSupplier liveNotificationCount) {
         mContext = context;
         mTextClassificationManager = mContext.getSystemService(TextClassificationManager.class);
         mSettings = settings;
+        mLatencies = latencies;
+        mSessions = new SessionStore(liveNotificationCount);
+        mEventContext = new TextClassificationContext.Builder(
+                mContext.getPackageName(), TextClassifier.WIDGET_TYPE_NOTIFICATION)
+                .build();
+        mInferenceExecutor = new ThreadPoolExecutor(1, 1,
+                INFERENCE_THREAD_KEEP_ALIVE_MS, TimeUnit.MILLISECONDS,
+                new LinkedBlockingQueue<>(MAX_PENDING_INFERENCES),
+                runnable -> {
+                    Thread thread = new Thread(runnable, "ExtAssistant.inference");
+                    thread.setDaemon(true);
+                    return thread;
+                });
+        mInferenceExecutor.allowCoreThreadTimeOut(true);
+    }
+
+    /** Stops the inference thread once the calls already made to the classifier return. */
+    void destroy() {
+        mInferenceExecutor.shutdown();
+    }
+
+    MessageWindowCache getMessageWindows() {
+        return mMessageWindows;
+    }
+
+    /**
+     * Forgets what was kept for a notification that is no longer showing, and abandons the
+     * suggestions being worked out for it.
+     *
+     * @return the session of the notification, to pass to {@link #endSession} once the events
+     *         already made for the notification are logged
+     */
+    @Nullable
+    SessionStore.Session onNotificationRemoved(String key) {
+        mMessageWindows.remove(key);
+        return mSessions.onNotificationRemoved(key);
+    }
+
+    /** Ends the session of a removed notification, unless it was re-posted with a new one. */
+    void endSession(String key, @Nullable SessionStore.Session session) {
+        if (session != null) {
+            mSessions.remove(key, session);
+        }
+    }
+
+    /** Number of suggestions given up on because the classifier missed the deadline. */
+    long getSuggestTimeoutCount() {
+        return mSuggestTimeouts.get();
+    }
+
+    SessionStore getSessions() {
+        return mSessions;
+    }
+
+    ConversationActionsCache getResultCache() {
+        return mResultCache;
     }
 
     SmartSuggestions suggest(NotificationEntry entry) {
         // Whenever suggest() is called on a notification, its previous session is ended.
-        mSessionCache.remove(entry.getSbn().getKey());
+        final Object sessionToken = mSessions.startSuggesting(entry.getSbn().getKey());
 
         boolean eligibleForReplyAdjustment =
                 mSettings.mGenerateReplies && isEligibleForReplyAdjustment(entry);
@@ -102,19 +196,20 @@ public class SmartActionsHelper {
                         eligibleForReplyAdjustment,
                         eligibleForActionAdjustment);
 
+        final long buildStart = LatencyHistograms.start();
         String resultId = conversationActionsResult.getId();
         List<ConversationAction> conversationActions =
                 conversationActionsResult.getConversationActions();
 
         ArrayList<CharSequence> replies = new ArrayList<>();
-        Map<CharSequence, Float> repliesScore = new ArrayMap<>();
+        float[] repliesScores = new float[conversationActions.size()];
         for (ConversationAction conversationAction : conversationActions) {
             CharSequence textReply = conversationAction.getTextReply();
             if (TextUtils.isEmpty(textReply)) {
                 continue;
             }
+            repliesScores[replies.size()] = conversationAction.getConfidenceScore();
             replies.add(textReply);
-            repliesScore.put(textReply, conversationAction.getConfidenceScore());
         }
 
         ArrayList<Notification.Action> actions = new ArrayList<>();
@@ -138,13 +233,18 @@ public class SmartActionsHelper {
         }
 
         // Start a new session for logging if necessary.
+        SessionStore.Session session = null;
         if (!TextUtils.isEmpty(resultId)
                 && !conversationActions.isEmpty()
                 && suggestionsMightBeUsedInNotification(
                 entry, !actions.isEmpty(), !replies.isEmpty())) {
-            mSessionCache.put(entry.getSbn().getKey(), new Session(resultId, repliesScore));
+            session = new SessionStore.Session(resultId,
+                    replies.toArray(new CharSequence[0]),
+                    Arrays.copyOf(repliesScores, replies.size()));
         }
+        mSessions.finishSuggesting(entry.getSbn().getKey(), sessionToken, session);
 
+        mLatencies.recordSince(LatencyHistograms.STAGE_BUILD_ACTIONS, buildStart);
         return new SmartSuggestions(replies, actions);
     }
 
@@ -241,7 +341,7 @@ public class SmartActionsHelper {
                                 .map(ConversationAction::getType)
                                 .toArray(String[]::new))
                         .build();
-        getTextClassifier().onTextClassifierEvent(textClassifierEvent);
+        reportEvent(textClassifierEvent);
     }
 
     /**
@@ -254,7 +354,10 @@ public class SmartActionsHelper {
         if (!includeReplies && !includeActions) {
             return EMPTY_CONVERSATION_ACTIONS;
         }
-        List<ConversationActions.Message> messages = extractMessages(entry.getNotification());
+        final long extractStart = LatencyHistograms.start();
+        List<ConversationActions.Message> messages =
+                extractMessages(entry.getSbn().getKey(), entry.getNotification());
+        mLatencies.recordSince(LatencyHistograms.STAGE_EXTRACT_MESSAGES, extractStart);
         if (messages.isEmpty()) {
             return EMPTY_CONVERSATION_ACTIONS;
         }
@@ -276,14 +379,55 @@ public class SmartActionsHelper {
                             Collections.singletonList(ConversationAction.TYPE_TEXT_REPLY))
                     .includeTypesFromTextClassifier(false);
         }
+        // An identical conversation was classified recently; its result was already reported.
+        final ConversationActionsCache.Key cacheKey = new ConversationActionsCache.Key(
+                messages, includeReplies, includeActions, mSettings.mMaxSuggestions);
+        final long nowMs = SystemClock.elapsedRealtime();
+        final ConversationActions cached = mResultCache.get(cacheKey, nowMs);
+        if (cached != null) {
+            return cached;
+        }
         ConversationActions.Request request =
                 new ConversationActions.Request.Builder(messages)
                         .setMaxSuggestions(mSettings.mMaxSuggestions)
                         .setHints(HINTS)
                         .setTypeConfig(typeConfigBuilder.build())
                         .build();
+        final long deadlineMs = mSettings.mSuggestDeadlineMs;
+        if (deadlineMs <= 0) {
+            return classify(request, cacheKey, nowMs);
+        }
+        // A late result is still cached and reported, so a re-post of the conversation gets it.
+        final Future<ConversationActions> future;
+        try {
+            future = mInferenceExecutor.submit(() -> classify(request, cacheKey, nowMs));
+        } catch (RejectedExecutionException e) {
+            mSuggestTimeouts.incrementAndGet();
+            return EMPTY_CONVERSATION_ACTIONS;
+        }
+        try {
+            return future.get(deadlineMs, TimeUnit.MILLISECONDS);
+        } catch (TimeoutException e) {
+            mSuggestTimeouts.incrementAndGet();
+            return EMPTY_CONVERSATION_ACTIONS;
+        } catch (ExecutionException e) {
+            Log.e(TAG, "Failed to suggest conversation actions", e.getCause());
+            return EMPTY_CONVERSATION_ACTIONS;
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+            return EMPTY_CONVERSATION_ACTIONS;
+        }
+    }
+
+    private ConversationActions classify(
+            ConversationActions.Request request, ConversationActionsCache.Key cacheKey,
+            long requestMs) {
+        final long suggestStart = LatencyHistograms.start();
         ConversationActions conversationActions =
                 getTextClassifier().suggestConversationActions(request);
+        mLatencies.recordSince(LatencyHistograms.STAGE_SUGGEST, suggestStart);
+        mResultCache.put(cacheKey, conversationActions, requestMs,
+                SystemClock.elapsedRealtime() - requestMs);
         reportActionsGenerated(
                 conversationActions.getId(), conversationActions.getConversationActions());
         return conversationActions;
@@ -293,25 +437,24 @@ public class SmartActionsHelper {
         if (!isExpanded) {
             return;
         }
-        Session session = mSessionCache.get(entry.getSbn().getKey());
+        SessionStore.Session session = mSessions.get(entry.getSbn().getKey());
         if (session == null) {
             return;
         }
         // Only report if this is the first time the user sees these suggestions.
-        if (entry.isShowActionEventLogged()) {
+        if (!entry.setShowActionEventLogged()) {
             return;
         }
-        entry.setShowActionEventLogged();
         TextClassifierEvent textClassifierEvent =
                 createTextClassifierEventBuilder(
                         TextClassifierEvent.TYPE_ACTIONS_SHOWN, session.resultId)
                         .build();
         // TODO: If possible, report which replies / actions are actually seen by user.
-        getTextClassifier().onTextClassifierEvent(textClassifierEvent);
+        reportEvent(textClassifierEvent);
     }
 
     void onNotificationDirectReplied(String key) {
-        Session session = mSessionCache.get(key);
+        SessionStore.Session session = mSessions.get(key);
         if (session == null) {
             return;
         }
@@ -319,7 +462,7 @@ public class SmartActionsHelper {
                 createTextClassifierEventBuilder(
                         TextClassifierEvent.TYPE_MANUAL_REPLY, session.resultId)
                         .build();
-        getTextClassifier().onTextClassifierEvent(textClassifierEvent);
+        reportEvent(textClassifierEvent);
     }
 
     void onSuggestedReplySent(String key, CharSequence reply,
@@ -327,7 +470,7 @@ public class SmartActionsHelper {
         if (source != NotificationAssistantService.SOURCE_FROM_ASSISTANT) {
             return;
         }
-        Session session = mSessionCache.get(key);
+        SessionStore.Session session = mSessions.get(key);
         if (session == null) {
             return;
         }
@@ -335,9 +478,9 @@ public class SmartActionsHelper {
                 createTextClassifierEventBuilder(
                         TextClassifierEvent.TYPE_SMART_ACTION, session.resultId)
                         .setEntityTypes(ConversationAction.TYPE_TEXT_REPLY)
-                        .setScores(session.repliesScores.getOrDefault(reply, 0f))
+                        .setScores(session.getReplyScore(reply))
                         .build();
-        getTextClassifier().onTextClassifierEvent(textClassifierEvent);
+        reportEvent(textClassifierEvent);
     }
 
     void onActionClicked(String key, Notification.Action action,
@@ -345,7 +488,7 @@ public class SmartActionsHelper {
         if (source != NotificationAssistantService.SOURCE_FROM_ASSISTANT) {
             return;
         }
-        Session session = mSessionCache.get(key);
+        SessionStore.Session session = mSessions.get(key);
         if (session == null) {
             return;
         }
@@ -358,7 +501,11 @@ public class SmartActionsHelper {
                         TextClassifierEvent.TYPE_SMART_ACTION, session.resultId)
                         .setEntityTypes(actionType)
                         .build();
-        getTextClassifier().onTextClassifierEvent(textClassifierEvent);
+        reportEvent(textClassifierEvent);
+    }
+
+    private void reportEvent(TextClassifierEvent event) {
+        getTextClassifier().onTextClassifierEvent(event);
     }
 
     private Notification.Action createNotificationActionFromRemoteAction(
@@ -381,10 +528,7 @@ public class SmartActionsHelper {
     private TextClassifierEvent.ConversationActionsEvent.Builder createTextClassifierEventBuilder(
             int eventType, String resultId) {
         return new TextClassifierEvent.ConversationActionsEvent.Builder(eventType)
-                .setEventContext(
-                        new TextClassificationContext.Builder(
-                                mContext.getPackageName(), TextClassifier.WIDGET_TYPE_NOTIFICATION)
-                        .build())
+                .setEventContext(mEventContext)
                 .setResultId(resultId);
     }
 
@@ -431,43 +575,65 @@ public class SmartActionsHelper {
         return true;
     }
 
-    /** Returns the text most salient for action extraction in a notification. */
-    private List<ConversationActions.Message> extractMessages(Notification notification) {
-        Parcelable[] messages = notification.extras.getParcelableArray(Notification.EXTRA_MESSAGES);
-        if (messages == null || messages.length == 0) {
+    /**
+     * Returns the text most salient for action extraction in a notification. Messages that were
+     * extracted from the previous post of the notification are not converted again.
+     */
+    private List<ConversationActions.Message> extractMessages(
+            String key, Notification notification) {
+        Parcelable[] bundles = notification.extras.getParcelableArray(Notification.EXTRA_MESSAGES);
+        if (bundles == null || bundles.length == 0) {
+            mMessageWindows.remove(key);
             return Collections.singletonList(new ConversationActions.Message.Builder(
                     ConversationActions.Message.PERSON_USER_OTHERS)
                     .setText(notification.extras.getCharSequence(Notification.EXTRA_TEXT))
                     .build());
         }
         Person localUser = notification.extras.getParcelable(Notification.EXTRA_MESSAGING_PERSON);
+        List<Notification.MessagingStyle.Message> messages =
+                Notification.MessagingStyle.Message.getMessagesFromBundleArray(bundles);
+        MessageWindowCache.Window previous = mMessageWindows.get(key);
+        if (previous != null && !MessageWindowCache.isSamePerson(previous.localUser, localUser)) {
+            previous = null;
+        }
+        List<MessageWindowCache.Item> items = new ArrayList<>();
+        int converted = 0;
         Deque<ConversationActions.Message> extractMessages = new ArrayDeque<>();
-        for (int i = messages.length - 1; i >= 0; i--) {
-            Notification.MessagingStyle.Message message =
-                    Notification.MessagingStyle.Message.getMessageFromBundle((Bundle) messages[i]);
-            if (message == null) {
-                continue;
-            }
-            // As per the javadoc of Notification.addMessage, null means local user.
-            Person senderPerson = message.getSenderPerson();
-            if (senderPerson == null) {
-                senderPerson = localUser;
+        for (int i = messages.size() - 1; i >= 0; i--) {
+            Notification.MessagingStyle.Message message = messages.get(i);
+            MessageWindowCache.Item item = previous == null ? null : previous.find(message);
+            if (item == null) {
+                item = new MessageWindowCache.Item(message, convertMessage(message, localUser));
+                converted++;
             }
-            Person author = localUser != null && arePersonsEqual(localUser, senderPerson)
-                    ? ConversationActions.Message.PERSON_USER_SELF : senderPerson;
-            extractMessages.push(new ConversationActions.Message.Builder(author)
-                    .setText(message.getText())
-                    .setReferenceTime(
-                            ZonedDateTime.ofInstant(Instant.ofEpochMilli(message.getTimestamp()),
-                                    ZoneOffset.systemDefault()))
-                    .build());
+            items.add(item);
+            extractMessages.push(item.message);
             if (extractMessages.size() >= mSettings.mMaxMessagesToExtract) {
                 break;
             }
         }
+        mMessageWindows.put(key, new MessageWindowCache.Window(localUser, items),
+                converted, items.size() - converted);
         return new ArrayList<>(extractMessages);
     }
 
+    private static ConversationActions.Message convertMessage(
+            Notification.MessagingStyle.Message message, @Nullable Person localUser) {
+        // As per the javadoc of Notification.addMessage, null means local user.
+        Person senderPerson = message.getSenderPerson();
+        if (senderPerson == null) {
+            senderPerson = localUser;
+        }
+        Person author = localUser != null && arePersonsEqual(localUser, senderPerson)
+                ? ConversationActions.Message.PERSON_USER_SELF : senderPerson;
+        return new ConversationActions.Message.Builder(author)
+                .setText(message.getText())
+                .setReferenceTime(
+                        ZonedDateTime.ofInstant(Instant.ofEpochMilli(message.getTimestamp()),
+                                ZoneOffset.systemDefault()))
+                .build();
+    }
+
     private TextClassifier getTextClassifier() {
         return mTextClassificationManager.getTextClassifier();
     }
@@ -488,14 +654,4 @@ public class SmartActionsHelper {
             this.actions = actions;
         }
     }
-
-    private static class Session {
-        public final String resultId;
-        public final Map<CharSequence, Float> repliesScores;
-
-        Session(String resultId, Map<CharSequence, Float> repliesScores) {
-            this.resultId = resultId;
-            this.repliesScores = repliesScores;
-        }
-    }
 }
@@ -0,0 +1,120 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.content.pm.ApplicationInfo;
+import android.content.pm.IPackageManager;
+import android.content.pm.PackageManager;
+import android.os.RemoteException;
+import android.util.ArrayMap;
+import android.util.Log;
+import android.util.SparseArray;
+
+import com.android.internal.annotations.GuardedBy;
+
+/**
+ * Caches the target SDK of packages, per user, so that building a {@link NotificationEntry}
+ * does not need an IPC to the package manager each time.
+ *
+ * <p>The owner invalidates a package when it is installed, updated or removed. A lookup that
+ * races with an invalidation does not store its result, since it may be from before the
+ * change.
+ */
+final class TargetSdkCache {
+    private static final String TAG = "ExtAssistant.SdkCache";
+
+    /** Returned when the package could not be looked up. */
+    static final int UNKNOWN = -1;
+
+    private final IPackageManager mPackageManager;
+
+    private final Object mLock = new Object();
+    // user id : package : target SDK
+    @GuardedBy("mLock")
+    private final SparseArray<ArrayMap<String, Integer>> mTargetSdks = new SparseArray<>();
+    // Bumped by every invalidation.
+    @GuardedBy("mLock")
+    private int mGeneration;
+    @GuardedBy("mLock")
+    private long mHits;
+    @GuardedBy("mLock")
+    private long mMisses;
+
+    TargetSdkCache(@NonNull IPackageManager packageManager) {
+        mPackageManager = packageManager;
+    }
+
+    /** Returns the target SDK of {@code pkg} for {@code userId}, or {@link #UNKNOWN}. */
+    int getTargetSdk(@NonNull String pkg, int userId) {
+        final int generation;
+        synchronized (mLock) {
+            final ArrayMap<String, Integer> packages = mTargetSdks.get(userId);
+            final Integer targetSdk = packages == null ? null : packages.get(pkg);
+            if (targetSdk != null) {
+                mHits++;
+                return targetSdk;
+            }
+            mMisses++;
+            generation = mGeneration;
+        }
+        final ApplicationInfo info;
+        try {
+            info = mPackageManager.getApplicationInfo(pkg, PackageManager.MATCH_ALL, userId);
+        } catch (RemoteException e) {
+            Log.w(TAG, "Couldn't look up " + pkg);
+            return UNKNOWN;
+        }
+        if (info == null) {
+            return UNKNOWN;
+        }
+        synchronized (mLock) {
+            if (generation == mGeneration) {
+                ArrayMap<String, Integer> packages = mTargetSdks.get(userId);
+                if (packages == null) {
+                    packages = new ArrayMap<>();
+                    mTargetSdks.put(userId, packages);
+                }
+                packages.put(pkg, info.targetSdkVersion);
+            }
+        }
+        return info.targetSdkVersion;
+    }
+
+    /** Forgets the target SDK of {@code pkg} for {@code userId}. */
+    void invalidate(@NonNull String pkg, int userId) {
+        synchronized (mLock) {
+            mGeneration++;
+            final ArrayMap<String, Integer> packages = mTargetSdks.get(userId);
+            if (packages != null) {
+                packages.remove(pkg);
+            }
+        }
+    }
+
+    long getHitCount() {
+        synchronized (mLock) {
+            return mHits;
+        }
+    }
+
+    long getMissCount() {
+        synchronized (mLock) {
+            return mMisses;
+        }
+    }
+}
@@ -0,0 +1,152 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import android.annotation.NonNull;
+import android.os.Handler;
+import android.os.Looper;
+import android.os.SystemClock;
+
+import com.android.internal.annotations.GuardedBy;
+
+/**
+ * Coalesces write requests so that a writer runs at most once per window.
+ *
+ * <p>The first {@link #markDirty()} after a write schedules the writer on the handler after the
+ * window has elapsed; further requests made before then are folded into that write. A request
+ * made while the writer is running schedules another write, so no change is ever dropped.
+ */
+final class WriteBehindScheduler {
+    private final Handler mHandler;
+    private final Runnable mWriter;
+    private final Runnable mWriteRunnable = this::runPendingWrite;
+
+    private final Object mLock = new Object();
+    @GuardedBy("mLock")
+    private long mWindowMs;
+    @GuardedBy("mLock")
+    private boolean mDirty;
+    @GuardedBy("mLock")
+    private long mRequestedWrites;
+    @GuardedBy("mLock")
+    private long mCoalescedWrites;
+    @GuardedBy("mLock")
+    private long mExecutedWrites;
+    @GuardedBy("mLock")
+    private long mTotalWriteUs;
+    @GuardedBy("mLock")
+    private long mLongestWriteUs;
+
+    /**
+     * @param handler the handler whose thread the writer is run on
+     * @param writer writes the current state out; always called on {@code handler}'s thread
+     * @param windowMs minimum time between the first request and the write that serves it
+     */
+    WriteBehindScheduler(@NonNull Handler handler, @NonNull Runnable writer, long windowMs) {
+        mHandler = handler;
+        mWriter = writer;
+        mWindowMs = windowMs;
+    }
+
+    void setWindowMs(long windowMs) {
+        synchronized (mLock) {
+            mWindowMs = windowMs;
+        }
+    }
+
+    /** Requests that the writer runs once the current window elapses. */
+    void markDirty() {
+        final long delay;
+        synchronized (mLock) {
+            mRequestedWrites++;
+            if (mDirty) {
+                mCoalescedWrites++;
+                return;
+            }
+            mDirty = true;
+            delay = mWindowMs;
+        }
+        mHandler.postDelayed(mWriteRunnable, delay);
+    }
+
+    /**
+     * Runs any pending write immediately and waits for it to finish. Safe to call from any
+     * thread, including the handler's.
+     */
+    void flush() {
+        mHandler.removeCallbacks(mWriteRunnable);
+        if (Looper.myLooper() == mHandler.getLooper()) {
+            runPendingWrite();
+        } else {
+            mHandler.runWithScissors(mWriteRunnable, 0);
+        }
+    }
+
+    boolean isDirty() {
+        synchronized (mLock) {
+            return mDirty;
+        }
+    }
+
+    long getRequestedWriteCount() {
+        synchronized (mLock) {
+            return mRequestedWrites;
+        }
+    }
+
+    long getCoalescedWriteCount() {
+        synchronized (mLock) {
+            return mCoalescedWrites;
+        }
+    }
+
+    long getExecutedWriteCount() {
+        synchronized (mLock) {
+            return mExecutedWrites;
+        }
+    }
+
+    /** Time spent in the writer over all writes, in microseconds. */
+    long getTotalWriteUs() {
+        synchronized (mLock) {
+            return mTotalWriteUs;
+        }
+    }
+
+    long getLongestWriteUs() {
+        synchronized (mLock) {
+            return mLongestWriteUs;
+        }
+    }
+
+    private void runPendingWrite() {
+        synchronized (mLock) {
+            if (!mDirty) {
+                return;
+            }
+            mDirty = false;
+            mExecutedWrites++;
+        }
+        final long startNanos = SystemClock.elapsedRealtimeNanos();
+        mWriter.run();
+        final long writeUs = (SystemClock.elapsedRealtimeNanos() - startNanos) / 1000;
+        synchronized (mLock) {
+            mTotalWriteUs += writeUs;
+            mLongestWriteUs = Math.max(mLongestWriteUs, writeUs);
+        }
+    }
+}
@@ -212,6 +212,66 @@ public class AssistantSettingsTest {
         assertEquals(DEFAULT_MAX_SUGGESTIONS, mAssistantSettings.mMaxSuggestions);
     }
 
+    @Test
+    public void testImpressionsWriteDelay() {
+        runWithShellPermissionIdentity(() -> setProperty(
+                DeviceConfig.NAMESPACE_SYSTEMUI,
+                AssistantSettings.NAS_IMPRESSIONS_WRITE_DELAY_MS,
+                "250",
+                false /* makeDefault */));
+        mAssistantSettings.onDeviceConfigPropertiesChanged(DeviceConfig.NAMESPACE_SYSTEMUI);
+
+        assertEquals(250, mAssistantSettings.mImpressionsWriteDelayMs);
+    }
+
+    @Test
+    public void testImpressionsMaxAge() {
+        runWithShellPermissionIdentity(() -> setProperty(
+                DeviceConfig.NAMESPACE_SYSTEMUI,
+                AssistantSettings.NAS_IMPRESSIONS_MAX_AGE_MS,
+                "86400000",
+                false /* makeDefault */));
+        mAssistantSettings.onDeviceConfigPropertiesChanged(DeviceConfig.NAMESPACE_SYSTEMUI);
+
+        assertEquals(86400000L, mAssistantSettings.mImpressionsMaxAgeMs);
+    }
+
+    @Test
+    public void testAdjustmentBatchDeadline() {
+        runWithShellPermissionIdentity(() -> setProperty(
+                DeviceConfig.NAMESPACE_SYSTEMUI,
+                AssistantSettings.NAS_ADJUSTMENT_BATCH_DEADLINE_MS,
+                "0",
+                false /* makeDefault */));
+        mAssistantSettings.onDeviceConfigPropertiesChanged(DeviceConfig.NAMESPACE_SYSTEMUI);
+
+        assertEquals(0L, mAssistantSettings.mAdjustmentBatchDeadlineMs);
+    }
+
+    @Test
+    public void testLiveNotificationsMaxBytes() {
+        runWithShellPermissionIdentity(() -> setProperty(
+                DeviceConfig.NAMESPACE_SYSTEMUI,
+                AssistantSettings.NAS_LIVE_NOTIFICATIONS_MAX_BYTES,
+                "65536",
+                false /* makeDefault */));
+        mAssistantSettings.onDeviceConfigPropertiesChanged(DeviceConfig.NAMESPACE_SYSTEMUI);
+
+        assertEquals(65536L, mAssistantSettings.mLiveNotificationsMaxBytes);
+    }
+
+    @Test
+    public void testSuggestDeadlineMs() {
+        runWithShellPermissionIdentity(() -> setProperty(
+                DeviceConfig.NAMESPACE_SYSTEMUI,
+                AssistantSettings.NAS_SUGGEST_DEADLINE_MS,
+                "250",
+                false /* makeDefault */));
+        mAssistantSettings.onDeviceConfigPropertiesChanged(DeviceConfig.NAMESPACE_SYSTEMUI);
+
+        assertEquals(250L, mAssistantSettings.mSuggestDeadlineMs);
+    }
+
     @Test
     public void testStreakLimit() {
         verify(mOnUpdateRunnable, never()).run();
@@ -258,6 +318,17 @@ public class AssistantSettingsTest {
                 + SystemUiDeviceConfigFlags.NAS_MAX_MESSAGES_TO_EXTRACT);
         uiDevice.executeShellCommand(
                 CLEAR_DEVICE_CONFIG_KEY_CMD + " " + SystemUiDeviceConfigFlags.NAS_MAX_SUGGESTIONS);
+        uiDevice.executeShellCommand(
+                CLEAR_DEVICE_CONFIG_KEY_CMD + " "
+                + AssistantSettings.NAS_IMPRESSIONS_WRITE_DELAY_MS);
+        uiDevice.executeShellCommand(
+                CLEAR_DEVICE_CONFIG_KEY_CMD + " " + AssistantSettings.NAS_IMPRESSIONS_MAX_AGE_MS);
+        uiDevice.executeShellCommand(CLEAR_DEVICE_CONFIG_KEY_CMD + " "
+                + AssistantSettings.NAS_ADJUSTMENT_BATCH_DEADLINE_MS);
+        uiDevice.executeShellCommand(CLEAR_DEVICE_CONFIG_KEY_CMD + " "
+                + AssistantSettings.NAS_LIVE_NOTIFICATIONS_MAX_BYTES);
+        uiDevice.executeShellCommand(CLEAR_DEVICE_CONFIG_KEY_CMD + " "
+                + AssistantSettings.NAS_SUGGEST_DEADLINE_MS);
     }
 
 }
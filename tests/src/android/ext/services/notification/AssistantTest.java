@@ -47,24 +47,28 @@ import android.service.notification.StatusBarNotification;
 import android.test.ServiceTestCase;
 import android.testing.TestableContext;
 import android.util.AtomicFile;
+import android.util.proto.ProtoInputStream;
+import android.util.proto.ProtoOutputStream;
 
 import androidx.test.InstrumentationRegistry;
 
-import com.android.internal.util.FastXmlSerializer;
-
 import org.junit.Before;
 import org.junit.Rule;
 import org.junit.Test;
 import org.mockito.ArgumentCaptor;
 import org.mockito.Mock;
 import org.mockito.MockitoAnnotations;
-import org.xmlpull.v1.XmlSerializer;
 
 import java.io.BufferedInputStream;
-import java.io.BufferedOutputStream;
 import java.io.ByteArrayInputStream;
 import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
 import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.PrintWriter;
+import java.io.StringWriter;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 
 public class AssistantTest extends ServiceTestCase<Assistant> {
@@ -123,6 +127,9 @@ public class AssistantTest extends ServiceTestCase<Assistant> {
         mAssistant.mSettings.mDismissToViewRatioLimit = 0.8f;
         mAssistant.mSettings.mStreakLimit = 2;
         mAssistant.mSettings.mNewInterruptionModel = true;
+        // Deliver adjustments as they are made, so tests can verify them right away.
+        mAssistant.mSettings.mAdjustmentBatchDeadlineMs = 0;
+        mAssistant.mSettings.mOnUpdateRunnable.run();
         mAssistant.setNoMan(mNoMan);
         mAssistant.setFile(mFile);
         mAssistant.setPackageManager(mPackageManager);
@@ -134,6 +141,21 @@ public class AssistantTest extends ServiceTestCase<Assistant> {
         when(mFile.startWrite()).thenReturn(mock(FileOutputStream.class));
     }
 
+    private static AtomicFile createImpressionsFile() throws IOException {
+        File file = File.createTempFile("impressions", ".bin");
+        file.delete();
+        return new AtomicFile(file);
+    }
+
+    private static ChannelImpressions getMappedImpressions(ImpressionsSnapshot.Mapped mapped,
+            String pkg, int userId, String channelId) {
+        int record = mapped.find(pkg, userId, channelId);
+        ChannelImpressions ci = new ChannelImpressions();
+        ci.setCounts(mapped.getDismissals(record), mapped.getViews(record),
+                mapped.getStreak(record));
+        return ci;
+    }
+
     private StatusBarNotification generateSbn(String pkg, int uid, NotificationChannel channel,
             String tag, String groupKey) {
         Notification n = new Notification.Builder(mContext, channel.getId())
@@ -337,8 +359,74 @@ public class AssistantTest extends ServiceTestCase<Assistant> {
         verify(mNoMan, never()).applyEnqueuedAdjustmentFromAssistant(any(), any());
     }
 
+    @Test
+    public void testImpressionWritesAreCoalesced() throws Exception {
+        mAssistant.getImpressionsWriter().setWindowMs(60_000);
+
+        almostBlockChannel(PKG1, UID1, P1C1);
+        dismissBadNotification(PKG1, UID1, P1C1, "trigger!");
+
+        WriteBehindScheduler writer = mAssistant.getImpressionsWriter();
+        assertEquals(3, writer.getRequestedWriteCount());
+        assertEquals(2, writer.getCoalescedWriteCount());
+        assertEquals(0, writer.getExecutedWriteCount());
+        verify(mFile, never()).startWrite();
+
+        mAssistant.onListenerDisconnected();
+
+        assertEquals(1, writer.getExecutedWriteCount());
+        verify(mFile, times(1)).finishWrite(any());
+    }
+
+    @Test
+    public void testImpressionEventsBufferedWhileLoading() throws Exception {
+        String key = mAssistant.getKey(PKG1, UserHandle.SYSTEM.getIdentifier(), P1C1.getId());
+        mAssistant.startImpressionsLoad();
+
+        almostBlockChannel(PKG1, UID1, P1C1);
+        dismissBadNotification(PKG1, UID1, P1C1, "trigger!");
+        assertNull(mAssistant.getImpressions(key));
+
+        // Simulate the stored counts arriving from disk.
+        ChannelImpressions stored = new ChannelImpressions();
+        stored.setCounts(0, 1, 0);
+        mAssistant.insertImpressions(key, stored);
+        mAssistant.finishImpressionsLoad();
+
+        ChannelImpressions ci = mAssistant.getImpressions(key);
+        assertEquals(3, ci.getDismissals());
+        assertEquals(4, ci.getViews());
+        assertEquals(3, ci.getStreak());
+        assertTrue(mAssistant.getImpressionsTimeToReadyMs() >= 0);
+    }
+
+    @Test
+    public void testImpressionsPromotedFromMappedSnapshot() throws Exception {
+        String key = mAssistant.getKey(PKG1, UserHandle.SYSTEM.getIdentifier(), P1C1.getId());
+        ChannelImpressions stored = new ChannelImpressions();
+        for (int i = 0; i <= ChannelImpressions.DEFAULT_STREAK_LIMIT; i++) {
+            stored.incrementViews();
+            stored.incrementDismissals();
+        }
+        ChannelImpressionsTable impressions = new ChannelImpressionsTable();
+        impressions.put(key, stored);
+        ByteArrayOutputStream baos = new ByteArrayOutputStream();
+        ImpressionsSnapshot.write(baos, impressions, 0, null, null);
+        mAssistant.setMappedSnapshot(
+                new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(baos.toByteArray())));
+
+        // Stored counts are picked up the first time the channel is seen.
+        StatusBarNotification sbn = generateSbn(PKG1, UID1, P1C1, "new one!", null);
+        mAssistant.setFakeRanking(generateRanking(sbn, P1C1));
+        mAssistant.onNotificationPosted(sbn, mock(RankingMap.class));
+
+        verify(mNoMan, times(1)).applyEnqueuedAdjustmentFromAssistant(any(), any());
+        assertEquals(stored, mAssistant.getImpressions(key));
+    }
+
     @Test
     public void testReadXml() throws Exception {
+        long before = System.currentTimeMillis();
         String key1 = mAssistant.getKey("pkg1", 1, "channel1");
         int streak1 = 2;
         int views1 = 5;
@@ -382,44 +470,70 @@ public class AssistantTest extends ServiceTestCase<Assistant> {
         assertEquals(7, c2.getStreak());
         assertEquals(77, c2.getViews());
         assertEquals(777, c2.getDismissals());
+        // Migrated channels age from when they were read.
+        assertTrue(c2.getLastUpdatedMs() >= before);
     }
 
     @Test
-    public void testRoundTripXml() throws Exception {
-        String key1 = mAssistant.getKey("pkg1", 1, "channel1");
+    public void testImpressionsWrittenToSnapshot() throws Exception {
         ChannelImpressions ci1 = new ChannelImpressions();
-        String key2 = mAssistant.getKey("pkg1", 1, "channel2");
         ChannelImpressions ci2 = new ChannelImpressions();
         for (int i = 0; i < 3; i++) {
             ci2.incrementViews();
             ci2.incrementDismissals();
         }
         ChannelImpressions ci3 = new ChannelImpressions();
-        String key3 = mAssistant.getKey("pkg3", 3, "channel2");
         for (int i = 0; i < 9; i++) {
             ci3.incrementViews();
             if (i % 3 == 0) {
                 ci3.incrementDismissals();
             }
         }
+        mAssistant.insertImpressions(mAssistant.getKey("pkg1", 1, "channel1"), ci1);
+        mAssistant.insertImpressions(mAssistant.getKey("pkg1", 1, "channel2"), ci2);
+        mAssistant.insertImpressions(mAssistant.getKey("pkg3", 3, "channel2"), ci3);
+
+        AtomicFile file = createImpressionsFile();
+        try {
+            mAssistant.setFile(file);
+            mAssistant.getImpressionsWriter().markDirty();
+            mAssistant.onListenerDisconnected();
+
+            ImpressionsSnapshot.Mapped mapped;
+            try (FileInputStream in = file.openRead()) {
+                mapped = ImpressionsSnapshot.Mapped.map(in, true);
+            }
+            assertEquals(3, mapped.size());
+            assertEquals(ci1, getMappedImpressions(mapped, "pkg1", 1, "channel1"));
+            assertEquals(ci2, getMappedImpressions(mapped, "pkg1", 1, "channel2"));
+            assertEquals(ci3, getMappedImpressions(mapped, "pkg3", 3, "channel2"));
+        } finally {
+            file.delete();
+        }
+    }
 
-        mAssistant.insertImpressions(key1, ci1);
-        mAssistant.insertImpressions(key2, ci2);
-        mAssistant.insertImpressions(key3, ci3);
-
-        XmlSerializer serializer = new FastXmlSerializer();
-        ByteArrayOutputStream baos = new ByteArrayOutputStream();
-        serializer.setOutput(new BufferedOutputStream(baos), "utf-8");
-        mAssistant.writeXml(serializer);
-
-        Assistant assistant = new Assistant();
-        // onCreate is not invoked, so settings won't be initialised, unless we do it here.
-        assistant.mSettings = mAssistant.mSettings;
-        assistant.readXml(new BufferedInputStream(new ByteArrayInputStream(baos.toByteArray())));
-
-        assertEquals(ci1, assistant.getImpressions(key1));
-        assertEquals(ci2, assistant.getImpressions(key2));
-        assertEquals(ci3, assistant.getImpressions(key3));
+    @Test
+    public void testImpressionsLoadedFromSnapshot() throws Exception {
+        String key = mAssistant.getKey("pkg1", 1, "channel1");
+        ChannelImpressions stored = new ChannelImpressions();
+        stored.setCounts(4, 9, 2);
+        ChannelImpressionsTable impressions = new ChannelImpressionsTable();
+        impressions.put(key, stored);
+
+        AtomicFile file = createImpressionsFile();
+        try {
+            FileOutputStream out = file.startWrite();
+            ImpressionsSnapshot.write(out, impressions, 0, null, null);
+            file.finishWrite(out);
+            mAssistant.setFile(file);
+            mAssistant.startImpressionsLoad();
+            mAssistant.loadImpressions();
+
+            assertEquals(stored, mAssistant.getImpressions(key));
+            assertTrue(mAssistant.getImpressionsTimeToReadyMs() >= 0);
+        } finally {
+            file.delete();
+        }
     }
 
     @Test
@@ -437,7 +551,7 @@ public class AssistantTest extends ServiceTestCase<Assistant> {
         mAssistant.insertImpressions(key, ci);
 
         // With default values, the blocking helper shouldn't be triggered.
-        assertEquals(false, ci.shouldTriggerBlock());
+        assertEquals(false, mAssistant.getImpressions(key).shouldTriggerBlock());
 
         // Update settings values.
         mAssistant.mSettings.mDismissToViewRatioLimit = 0f;
@@ -447,7 +561,7 @@ public class AssistantTest extends ServiceTestCase<Assistant> {
         mAssistant.mSettings.mOnUpdateRunnable.run();
 
         // With the new threshold, the blocking helper should be triggered.
-        assertEquals(true, ci.shouldTriggerBlock());
+        assertEquals(true, mAssistant.getImpressions(key).shouldTriggerBlock());
     }
 
     @Test
@@ -465,6 +579,66 @@ public class AssistantTest extends ServiceTestCase<Assistant> {
         assertFalse(mAssistant.mLiveNotifications.containsKey(sbn.getKey()));
     }
 
+    @Test
+    public void testDump() {
+        StatusBarNotification sbn = generateSbn(PKG1, UID1, P1C1, "no", null);
+        mAssistant.setFakeRanking(generateRanking(sbn, P1C1));
+        mAssistant.onNotificationPosted(sbn, mock(RankingMap.class));
+
+        StringWriter out = new StringWriter();
+        mAssistant.dump(null, new PrintWriter(out), new String[0]);
+
+        String dump = out.toString();
+        assertTrue(dump.contains("live notifications: 1,"));
+        assertTrue(dump.contains("latencies"));
+        assertTrue(dump.contains("settings:"));
+    }
+
+    @Test
+    public void testDumpProto() throws Exception {
+        StatusBarNotification sbn = generateSbn(PKG1, UID1, P1C1, "no", null);
+        mAssistant.setFakeRanking(generateRanking(sbn, P1C1));
+        mAssistant.onNotificationPosted(sbn, mock(RankingMap.class));
+
+        ProtoOutputStream proto = new ProtoOutputStream();
+        mAssistant.dumpProto(proto);
+
+        ProtoInputStream in = new ProtoInputStream(proto.getBytes());
+        int liveNotifications = -1;
+        while (in.nextField() != ProtoInputStream.NO_MORE_FIELDS) {
+            if (in.getFieldNumber() != (int) AssistantDumpProto.LIVE_NOTIFICATIONS) {
+                continue;
+            }
+            long token = in.start(AssistantDumpProto.LIVE_NOTIFICATIONS);
+            while (in.nextField() != ProtoInputStream.NO_MORE_FIELDS) {
+                if (in.getFieldNumber()
+                        == (int) AssistantDumpProto.LiveNotifications.COUNT) {
+                    liveNotifications =
+                            in.readInt(AssistantDumpProto.LiveNotifications.COUNT);
+                }
+            }
+            in.end(token);
+        }
+        assertEquals(1, liveNotifications);
+    }
+
+    @Test
+    public void testReplayActiveNotifications() {
+        int count = 40;
+        StatusBarNotification[] active = new StatusBarNotification[count];
+        for (int i = 0; i < count; i++) {
+            active[i] = generateSbn(PKG1, UID1, P1C1, "tag" + i, null);
+        }
+        mAssistant.setFakeRanking(generateRanking(active[0], P1C1));
+
+        mAssistant.replayActiveNotifications(active, mock(RankingMap.class));
+
+        assertEquals(count, mAssistant.getLastReplayCount());
+        for (StatusBarNotification sbn : active) {
+            assertTrue(mAssistant.mLiveNotifications.containsKey(sbn.getKey()));
+        }
+    }
+
     @Test
     public void testAssistantNeverIncreasesImportanceWhenSuggestingSilent() throws Exception {
         StatusBarNotification sbn = generateSbn(PKG1, UID1, P1C3, "min notif!", null);
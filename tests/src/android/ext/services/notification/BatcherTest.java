@@ -0,0 +1,131 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static junit.framework.Assert.assertTrue;
+
+import static org.junit.Assert.assertEquals;
+
+import android.os.Handler;
+import android.os.HandlerThread;
+
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+
+public class BatcherTest {
+    private static final int MAX_BATCH_SIZE = 4;
+    private static final long TIMEOUT_S = 5;
+
+    private HandlerThread mThread;
+    private Handler mHandler;
+    private final List<List<String>> mBatches = new ArrayList<>();
+    private final CountDownLatch mDelivered = new CountDownLatch(1);
+
+    @Before
+    public void setUp() {
+        mThread = new HandlerThread("BatcherTest");
+        mThread.start();
+        mHandler = new Handler(mThread.getLooper());
+    }
+
+    @After
+    public void tearDown() {
+        mThread.quitSafely();
+    }
+
+    private Batcher<String> createBatcher(long deadlineMs) {
+        return new Batcher<>(mHandler, items -> {
+            synchronized (mBatches) {
+                mBatches.add(new ArrayList<>(items));
+            }
+            mDelivered.countDown();
+        }, MAX_BATCH_SIZE, deadlineMs);
+    }
+
+    private static String item(int i) {
+        return "item" + i;
+    }
+
+    @Test
+    public void testBurstIsBatched() {
+        Batcher<String> batcher = createBatcher(10_000);
+        for (int i = 0; i < 3; i++) {
+            batcher.add(item(i));
+        }
+        synchronized (mBatches) {
+            assertTrue(mBatches.isEmpty());
+        }
+
+        batcher.flush();
+
+        assertEquals(1, mBatches.size());
+        assertEquals(3, mBatches.get(0).size());
+        assertEquals("item2", mBatches.get(0).get(2));
+        assertEquals(1, batcher.getBatchCount());
+        assertEquals(3, batcher.getItemCount());
+    }
+
+    @Test
+    public void testDeliveredByDeadline() throws Exception {
+        Batcher<String> batcher = createBatcher(20);
+        // Added on the handler, so that the deadline cannot pass between them.
+        mHandler.runWithScissors(() -> {
+            batcher.add(item(0));
+            batcher.add(item(1));
+        }, 0);
+
+        assertTrue(mDelivered.await(TIMEOUT_S, TimeUnit.SECONDS));
+        // Wait for anything still queued on the handler.
+        mHandler.runWithScissors(() -> {}, 0);
+
+        synchronized (mBatches) {
+            assertEquals(1, mBatches.size());
+            assertEquals(2, mBatches.get(0).size());
+        }
+    }
+
+    @Test
+    public void testFullBatchIsDeliveredEarly() {
+        Batcher<String> batcher = createBatcher(10_000);
+        for (int i = 0; i < MAX_BATCH_SIZE + 1; i++) {
+            batcher.add(item(i));
+        }
+
+        batcher.flush();
+
+        assertEquals(2, mBatches.size());
+        assertEquals(MAX_BATCH_SIZE, mBatches.get(0).size());
+        assertEquals(1, mBatches.get(1).size());
+        assertEquals(MAX_BATCH_SIZE, batcher.getLargestBatch());
+    }
+
+    @Test
+    public void testNoDeadlineDeliversImmediately() {
+        Batcher<String> batcher = createBatcher(0);
+        batcher.add(item(0));
+        batcher.add(item(1));
+
+        assertEquals(2, mBatches.size());
+        assertEquals(2, batcher.getBatchCount());
+    }
+}
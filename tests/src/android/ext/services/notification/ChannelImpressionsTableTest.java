@@ -0,0 +1,136 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static junit.framework.Assert.assertFalse;
+import static junit.framework.Assert.assertTrue;
+
+import static org.junit.Assert.assertEquals;
+
+import org.junit.Test;
+
+public class ChannelImpressionsTableTest {
+
+    @Test
+    public void testPutAndGet() {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        int one = table.put("pkg", 0, "one", 1, 2, 3, 4);
+        int two = table.put("pkg", 10, "one", 5, 6, 7, 8);
+
+        assertEquals(2, table.size());
+        assertEquals(one, table.indexOf("pkg", 0, "one"));
+        assertEquals(two, table.indexOf("pkg", 10, "one"));
+        assertEquals(-1, table.indexOf("pkg", 0, "two"));
+        assertEquals(-1, table.indexOf("other", 0, "one"));
+        assertEquals(5, table.dismissalsAt(two));
+        assertEquals(6, table.viewsAt(two));
+        assertEquals(7, table.streakAt(two));
+        assertEquals(8, table.lastUpdatedMsAt(two));
+    }
+
+    @Test
+    public void testPutReplaces() {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        int index = table.put("pkg", 0, "one", 1, 1, 1, 1);
+
+        assertEquals(index, table.put("pkg", 0, "one", 2, 2, 2, 2));
+        assertEquals(1, table.size());
+        assertEquals(2, table.dismissalsAt(index));
+    }
+
+    @Test
+    public void testCounters() {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        int index = table.put("pkg", 0, "one", 0, 0, 0, 0);
+        table.incrementViewsAt(index);
+        table.incrementDismissalsAt(index);
+        table.incrementDismissalsAt(index);
+
+        ChannelImpressions expected = new ChannelImpressions();
+        expected.incrementViews();
+        expected.incrementDismissals();
+        expected.incrementDismissals();
+        assertEquals(expected, table.getImpressionsAt(index));
+
+        table.resetStreakAt(index);
+        assertEquals(0, table.streakAt(index));
+        assertEquals(2, table.dismissalsAt(index));
+    }
+
+    @Test
+    public void testThresholdsAreShared() {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        int one = table.put("pkg", 0, "one", 3, 3, 3, 0);
+        int two = table.put("pkg", 0, "two", 2, 4, 1, 0);
+        assertTrue(table.shouldTriggerBlockAt(one));
+        assertFalse(table.shouldTriggerBlockAt(two));
+
+        table.setThresholds(0f, 0);
+
+        assertTrue(table.shouldTriggerBlockAt(one));
+        assertTrue(table.shouldTriggerBlockAt(two));
+        assertEquals(0, table.getImpressionsAt(two).getStreakLimit());
+    }
+
+    @Test
+    public void testJoinedKeys() {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        int index = table.put("pkg", 3, "chan|nel", 0, 0, 0, 0);
+
+        assertEquals("pkg|3|chan|nel", table.keyAt(index));
+        assertEquals(index, table.indexOfKey("pkg|3|chan|nel"));
+        assertEquals(index, table.put("pkg|3|chan|nel", new ChannelImpressions()));
+        assertEquals(-1, table.put("not a key", new ChannelImpressions()));
+    }
+
+    @Test
+    public void testGrowAndRemove() {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        int count = 1000;
+        for (int i = 0; i < count; i++) {
+            table.put("pkg" + (i % 37), i % 3, "channel" + i, i, i, i, i);
+        }
+        assertEquals(count, table.size());
+
+        // Remove every other channel, from the front so that entries move into the gaps.
+        for (int i = 0; i < count; i += 2) {
+            table.removeAt(table.indexOf("pkg" + (i % 37), i % 3, "channel" + i));
+        }
+
+        assertEquals(count / 2, table.size());
+        for (int i = 0; i < count; i++) {
+            int index = table.indexOf("pkg" + (i % 37), i % 3, "channel" + i);
+            if (i % 2 == 0) {
+                assertEquals(-1, index);
+            } else {
+                assertEquals("channel" + i, table.channelIdAt(index));
+                assertEquals(i % 3, table.userIdAt(index));
+                assertEquals(i, table.viewsAt(index));
+            }
+        }
+    }
+
+    @Test
+    public void testClear() {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        table.put("pkg", 0, "one", 0, 0, 0, 0);
+        table.clear();
+
+        assertEquals(0, table.size());
+        assertEquals(-1, table.indexOf("pkg", 0, "one"));
+    }
+}
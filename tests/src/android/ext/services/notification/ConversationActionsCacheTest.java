@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertNotEquals;
+import static org.junit.Assert.assertNull;
+import static org.junit.Assert.assertSame;
+
+import android.app.Person;
+import android.view.textclassifier.ConversationActions;
+
+import org.junit.Test;
+
+import java.time.ZoneOffset;
+import java.time.ZonedDateTime;
+import java.util.Arrays;
+import java.util.Collections;
+import java.util.List;
+
+public class ConversationActionsCacheTest {
+    private static final long TTL_MS = 1000;
+
+    private final ConversationActionsCache mCache = new ConversationActionsCache(2, TTL_MS);
+    private final ConversationActions mActions =
+            new ConversationActions(Collections.emptyList(), "id");
+
+    private static ConversationActions.Message message(String sender, String text) {
+        return message(sender, text, null);
+    }
+
+    private static ConversationActions.Message message(
+            String sender, String text, ZonedDateTime referenceTime) {
+        return new ConversationActions.Message.Builder(
+                new Person.Builder().setName(sender).build())
+                .setText(text)
+                .setReferenceTime(referenceTime)
+                .build();
+    }
+
+    private static long fingerprint(List<ConversationActions.Message> messages) {
+        return ConversationActionsCache.fingerprint(messages, true, true, 3);
+    }
+
+    private static ConversationActionsCache.Key key(String text) {
+        return new ConversationActionsCache.Key(
+                Collections.singletonList(message("a", text)), true, true, 3);
+    }
+
+    @Test
+    public void testFingerprintCoversContent() {
+        List<ConversationActions.Message> messages =
+                Arrays.asList(message("a", "hello"), message("b", "hi"));
+
+        assertEquals(fingerprint(messages),
+                fingerprint(Arrays.asList(message("a", "hello"), message("b", "hi"))));
+        assertNotEquals(fingerprint(messages),
+                fingerprint(Arrays.asList(message("a", "hello"), message("b", "hey"))));
+        assertNotEquals(fingerprint(messages),
+                fingerprint(Arrays.asList(message("a", "hello"), message("c", "hi"))));
+        assertNotEquals(fingerprint(messages),
+                fingerprint(Arrays.asList(message("a", "hellob"), message("", "hi"))));
+        assertNotEquals(fingerprint(messages),
+                ConversationActionsCache.fingerprint(messages, true, false, 3));
+        assertNotEquals(fingerprint(messages),
+                ConversationActionsCache.fingerprint(messages, true, true, 4));
+    }
+
+    @Test
+    public void testFingerprintCoversReferenceTime() {
+        ZonedDateTime time = ZonedDateTime.of(2019, 1, 1, 12, 0, 0, 0, ZoneOffset.UTC);
+        List<ConversationActions.Message> messages =
+                Collections.singletonList(message("a", "hello", time));
+
+        assertEquals(fingerprint(messages), fingerprint(Collections.singletonList(
+                message("a", "hello", time.withZoneSameInstant(ZoneOffset.ofHours(2))))));
+        assertNotEquals(fingerprint(messages), fingerprint(Collections.singletonList(
+                message("a", "hello", time.plusNanos(1_000_000)))));
+        assertNotEquals(fingerprint(messages),
+                fingerprint(Collections.singletonList(message("a", "hello"))));
+    }
+
+    @Test
+    public void testHit() {
+        mCache.put(key("hello"), mActions, 0, 40);
+
+        assertSame(mActions, mCache.get(key("hello"), 10));
+        assertNull(mCache.get(key("hi"), 10));
+        assertEquals(1, mCache.getHitCount());
+        assertEquals(1, mCache.getMissCount());
+        assertEquals(40, mCache.getSavedMs());
+    }
+
+    @Test
+    public void testCollisionIsNotAHit() {
+        List<ConversationActions.Message> hello = Collections.singletonList(message("a", "hello"));
+        List<ConversationActions.Message> hi = Collections.singletonList(message("a", "hi"));
+        mCache.put(new ConversationActionsCache.Key(hello, true, true, 3, 1L), mActions, 0, 40);
+
+        assertNull(mCache.get(new ConversationActionsCache.Key(hi, true, true, 3, 1L), 10));
+        assertNull(mCache.get(new ConversationActionsCache.Key(hello, true, false, 3, 1L), 10));
+        assertSame(mActions,
+                mCache.get(new ConversationActionsCache.Key(hello, true, true, 3, 1L), 10));
+    }
+
+    @Test
+    public void testExpires() {
+        mCache.put(key("hello"), mActions, 0, 40);
+
+        assertNull(mCache.get(key("hello"), TTL_MS + 1));
+    }
+
+    @Test
+    public void testOldestIsDropped() {
+        mCache.put(key("1"), mActions, 0, 0);
+        mCache.put(key("2"), mActions, 0, 0);
+        mCache.put(key("3"), mActions, 0, 0);
+
+        assertNull(mCache.get(key("1"), 0));
+        assertSame(mActions, mCache.get(key("2"), 0));
+        assertSame(mActions, mCache.get(key("3"), 0));
+    }
+}
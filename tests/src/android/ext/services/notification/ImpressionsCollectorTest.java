@@ -0,0 +1,170 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static junit.framework.Assert.assertFalse;
+import static junit.framework.Assert.assertTrue;
+
+import static org.junit.Assert.assertEquals;
+
+import android.os.Handler;
+import android.os.HandlerThread;
+
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+
+import java.util.List;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+
+public class ImpressionsCollectorTest {
+    private static final long MAX_AGE_MS = 60_000;
+
+    private HandlerThread mThread;
+    private Handler mHandler;
+    private final ChannelImpressionsTable mImpressions = new ChannelImpressionsTable();
+    private final CountDownLatch mCollected = new CountDownLatch(1);
+    private ImpressionsCollector mCollector;
+
+    @Before
+    public void setUp() {
+        mThread = new HandlerThread("ImpressionsCollectorTest");
+        mThread.start();
+        mHandler = new Handler(mThread.getLooper());
+        mCollector = new ImpressionsCollector(
+                mHandler, mImpressions, MAX_AGE_MS, () -> mCollected.countDown());
+    }
+
+    @After
+    public void tearDown() {
+        mThread.quitSafely();
+    }
+
+    private void put(String pkg, int userId, String channelId, long lastUpdatedMs) {
+        ChannelImpressions ci = new ChannelImpressions();
+        ci.setLastUpdatedMs(lastUpdatedMs);
+        synchronized (mImpressions) {
+            mImpressions.put(pkg, userId, channelId, ci);
+        }
+    }
+
+    private boolean contains(String pkg, int userId, String channelId) {
+        synchronized (mImpressions) {
+            return mImpressions.indexOf(pkg, userId, channelId) >= 0;
+        }
+    }
+
+    private void awaitCollected() throws Exception {
+        assertTrue(mCollected.await(5, TimeUnit.SECONDS));
+    }
+
+    @Test
+    public void testRemovedPackageIsCollected() throws Exception {
+        long now = System.currentTimeMillis();
+        put("pkg", 0, "one", now - 1);
+        put("pkg", 0, "two", now - 1);
+        put("pkg", 10, "one", now - 1);
+        put("pkg.other", 0, "one", now - 1);
+
+        mCollector.onPackageRemoved("pkg", 0);
+        awaitCollected();
+
+        assertFalse(contains("pkg", 0, "one"));
+        assertFalse(contains("pkg", 0, "two"));
+        assertTrue(contains("pkg", 10, "one"));
+        assertTrue(contains("pkg.other", 0, "one"));
+        assertEquals(2, mCollector.getReclaimedEntries());
+        assertTrue(mCollector.getReclaimedBytes() > 0);
+    }
+
+    @Test
+    public void testDeletedChannelIsCollected() throws Exception {
+        long now = System.currentTimeMillis();
+        put("pkg", 0, "one", now - 1);
+        put("pkg", 0, "two", now - 1);
+
+        mCollector.onChannelDeleted("pkg", 0, "one");
+        awaitCollected();
+
+        assertFalse(contains("pkg", 0, "one"));
+        assertTrue(contains("pkg", 0, "two"));
+    }
+
+    @Test
+    public void testOldChannelsAreCollected() throws Exception {
+        long now = System.currentTimeMillis();
+        put("pkg", 0, "old", now - 2 * MAX_AGE_MS);
+        put("pkg", 0, "recent", now);
+        put("pkg", 0, "unknown", 0);
+
+        mCollector.schedule();
+        awaitCollected();
+
+        assertFalse(contains("pkg", 0, "old"));
+        assertTrue(contains("pkg", 0, "recent"));
+        assertTrue(contains("pkg", 0, "unknown"));
+    }
+
+    @Test
+    public void testSweepRunsInSlices() throws Exception {
+        long old = System.currentTimeMillis() - 2 * MAX_AGE_MS;
+        int count = 3 * ImpressionsCollector.SLICE_MAX_ENTRIES;
+        for (int i = 0; i < count; i++) {
+            put("pkg" + i, 0, "channel", old);
+        }
+
+        mCollector.schedule();
+        awaitCollected();
+
+        synchronized (mImpressions) {
+            assertTrue(mImpressions.isEmpty());
+        }
+        assertEquals(count, mCollector.getReclaimedEntries());
+        assertEquals(1, mCollector.getSweepCount());
+    }
+
+    @Test
+    public void testRecreatedChannelIsKept() throws Exception {
+        long before = System.currentTimeMillis() - 1;
+        mCollector.onChannelDeleted("pkg", 0, "one");
+        awaitCollected();
+
+        // Impressions updated after the deletion belong to a new channel with the same id.
+        assertTrue(mCollector.shouldDrop("pkg", 0, "one", before));
+        assertFalse(mCollector.shouldDrop("pkg", 0, "one", System.currentTimeMillis() + 1));
+    }
+
+    @Test
+    public void testRemovalsForgottenOnceCommitted() throws Exception {
+        long before = System.currentTimeMillis() - 1;
+        mCollector.onPackageRemoved("pkg", 0);
+        awaitCollected();
+        assertTrue(mCollector.hasPendingRemovals());
+
+        List<ImpressionsCollector.Removal> removals;
+        synchronized (mImpressions) {
+            removals = mCollector.beginWriteLocked();
+        }
+        assertTrue(mCollector.shouldDrop("pkg", 0, "one", before));
+        mCollector.onSnapshotCommitted(removals, 5);
+
+        assertFalse(mCollector.hasPendingRemovals());
+        assertFalse(mCollector.shouldDrop("pkg", 0, "one", before));
+        assertEquals(5, mCollector.getDroppedRecords());
+    }
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static android.ext.services.notification.ImpressionsJournal.OP_DISMISSAL;
+import static android.ext.services.notification.ImpressionsJournal.OP_RESET_STREAK;
+import static android.ext.services.notification.ImpressionsJournal.OP_VIEW;
+
+import static junit.framework.Assert.assertTrue;
+
+import static org.junit.Assert.assertEquals;
+
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+
+import java.io.File;
+import java.io.RandomAccessFile;
+import java.util.ArrayList;
+import java.util.Arrays;
+import java.util.List;
+
+public class ImpressionsJournalTest {
+    private File mFile;
+
+    @Before
+    public void setUp() throws Exception {
+        mFile = File.createTempFile("impressions", ".journal");
+        mFile.delete();
+    }
+
+    @After
+    public void tearDown() {
+        mFile.delete();
+    }
+
+    private static List<String> replay(ImpressionsJournal journal, int generation)
+            throws Exception {
+        List<String> replayed = new ArrayList<>();
+        journal.replay(generation, (key, op) -> replayed.add(key + ":" + op));
+        return replayed;
+    }
+
+    @Test
+    public void testReplayMissingJournal() throws Exception {
+        ImpressionsJournal journal = new ImpressionsJournal(mFile);
+
+        assertTrue(replay(journal, 3).isEmpty());
+        assertEquals(3, journal.getGeneration());
+        assertEquals(ImpressionsJournal.HEADER_SIZE, mFile.length());
+    }
+
+    @Test
+    public void testAppendAndReplay() throws Exception {
+        ImpressionsJournal journal = new ImpressionsJournal(mFile);
+        journal.reset(1);
+        journal.append(Arrays.asList(
+                new ImpressionsJournal.Delta("a", OP_VIEW),
+                new ImpressionsJournal.Delta("b", OP_DISMISSAL)));
+        journal.append(Arrays.asList(new ImpressionsJournal.Delta("a", OP_RESET_STREAK)));
+        journal.close();
+
+        assertEquals(Arrays.asList("a:" + OP_VIEW, "b:" + OP_DISMISSAL, "a:" + OP_RESET_STREAK),
+                replay(new ImpressionsJournal(mFile), 1));
+    }
+
+    @Test
+    public void testKnownKeysAreNotRewritten() throws Exception {
+        ImpressionsJournal journal = new ImpressionsJournal(mFile);
+        journal.reset(1);
+        journal.append(Arrays.asList(new ImpressionsJournal.Delta("a.long.key", OP_VIEW)));
+        long first = journal.length();
+        journal.append(Arrays.asList(new ImpressionsJournal.Delta("a.long.key", OP_VIEW)));
+        long second = journal.length() - first;
+
+        // After replaying, the key keeps its id and appends stay as small.
+        ImpressionsJournal reopened = new ImpressionsJournal(mFile);
+        replay(reopened, 1);
+        reopened.append(Arrays.asList(new ImpressionsJournal.Delta("a.long.key", OP_VIEW)));
+
+        assertEquals(second, reopened.length() - journal.length());
+        assertEquals(3, replay(new ImpressionsJournal(mFile), 1).size());
+    }
+
+    @Test
+    public void testStaleGenerationIsDiscarded() throws Exception {
+        ImpressionsJournal journal = new ImpressionsJournal(mFile);
+        journal.reset(1);
+        journal.append(Arrays.asList(new ImpressionsJournal.Delta("a", OP_VIEW)));
+        journal.close();
+
+        // A snapshot with generation 2 already includes these changes.
+        ImpressionsJournal reopened = new ImpressionsJournal(mFile);
+        assertTrue(replay(reopened, 2).isEmpty());
+        assertEquals(2, reopened.getGeneration());
+        assertEquals(ImpressionsJournal.HEADER_SIZE, mFile.length());
+    }
+
+    @Test
+    public void testTornAppendIsDropped() throws Exception {
+        ImpressionsJournal journal = new ImpressionsJournal(mFile);
+        journal.reset(1);
+        journal.append(Arrays.asList(new ImpressionsJournal.Delta("a", OP_VIEW)));
+        long good = journal.length();
+        journal.append(Arrays.asList(new ImpressionsJournal.Delta("a", OP_DISMISSAL)));
+        journal.close();
+        try (RandomAccessFile file = new RandomAccessFile(mFile, "rw")) {
+            file.setLength(mFile.length() - 2);
+        }
+
+        ImpressionsJournal reopened = new ImpressionsJournal(mFile);
+        assertEquals(Arrays.asList("a:" + OP_VIEW), replay(reopened, 1));
+        assertEquals(good, mFile.length());
+
+        // New changes follow the last intact record.
+        reopened.append(Arrays.asList(new ImpressionsJournal.Delta("b", OP_RESET_STREAK)));
+        reopened.close();
+        assertEquals(Arrays.asList("a:" + OP_VIEW, "b:" + OP_RESET_STREAK),
+                replay(new ImpressionsJournal(mFile), 1));
+    }
+}
@@ -0,0 +1,290 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static junit.framework.Assert.assertNull;
+import static junit.framework.Assert.assertTrue;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.fail;
+
+import android.util.ArrayMap;
+
+import org.junit.Test;
+
+import java.io.ByteArrayOutputStream;
+import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.util.zip.CRC32;
+
+public class ImpressionsSnapshotTest {
+
+    private static ChannelImpressions createImpressions(int dismissals, int views, int streak) {
+        ChannelImpressions ci = new ChannelImpressions();
+        ci.setCounts(dismissals, views, streak);
+        return ci;
+    }
+
+    private static ChannelImpressionsTable toTable(
+            ArrayMap<String, ChannelImpressions> impressions) {
+        ChannelImpressionsTable table = new ChannelImpressionsTable();
+        for (int i = 0; i < impressions.size(); i++) {
+            table.put(impressions.keyAt(i), impressions.valueAt(i));
+        }
+        return table;
+    }
+
+    private static byte[] encode(ArrayMap<String, ChannelImpressions> impressions)
+            throws IOException {
+        ByteArrayOutputStream out = new ByteArrayOutputStream();
+        ImpressionsSnapshot.write(out, toTable(impressions), 0, null, null);
+        return out.toByteArray();
+    }
+
+    private static ArrayMap<String, ChannelImpressions> decode(byte[] bytes) throws IOException {
+        ImpressionsSnapshot.Mapped mapped = new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(bytes));
+        ArrayMap<String, ChannelImpressions> result = new ArrayMap<>();
+        for (int i = 0; i < mapped.size(); i++) {
+            ChannelImpressions ci = createImpressions(
+                    mapped.getDismissals(i), mapped.getViews(i), mapped.getStreak(i));
+            ci.setLastUpdatedMs(mapped.getLastUpdatedMs(i));
+            result.put(ImpressionsSnapshot.joinKey(
+                    mapped.getPackage(i), mapped.getUserId(i), mapped.getChannelId(i)), ci);
+        }
+        return result;
+    }
+
+    @Test
+    public void testRoundTrip() throws Exception {
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(ImpressionsSnapshot.joinKey("pkg1", 0, "one"), createImpressions(1, 2, 3));
+        impressions.put(ImpressionsSnapshot.joinKey("pkg1", 10, "one"), createImpressions(4, 5, 6));
+        impressions.put(ImpressionsSnapshot.joinKey("pkg2", 0, "a|b"), createImpressions(7, 8, 9));
+
+        assertEquals(impressions, decode(encode(impressions)));
+    }
+
+    @Test
+    public void testGeneration() throws Exception {
+        ByteArrayOutputStream out = new ByteArrayOutputStream();
+        ImpressionsSnapshot.write(out, new ChannelImpressionsTable(), 42, null, null);
+
+        assertEquals(42, new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(out.toByteArray()))
+                .getGeneration());
+    }
+
+    @Test
+    public void testRoundTrip_empty() throws Exception {
+        assertTrue(decode(encode(new ArrayMap<>())).isEmpty());
+    }
+
+    @Test
+    public void testStringsAreInterned() throws Exception {
+        ArrayMap<String, ChannelImpressions> one = new ArrayMap<>();
+        one.put(ImpressionsSnapshot.joinKey("a.long.package.name", 0, "channel"),
+                createImpressions(1, 1, 1));
+        ArrayMap<String, ChannelImpressions> two = new ArrayMap<>(one);
+        two.put(ImpressionsSnapshot.joinKey("a.long.package.name", 10, "channel"),
+                createImpressions(1, 1, 1));
+
+        // The second record only costs its fixed-width fields.
+        assertEquals(ImpressionsSnapshot.RECORD_SIZE, encode(two).length - encode(one).length);
+    }
+
+    @Test
+    public void testChecksumMismatch() throws Exception {
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(ImpressionsSnapshot.joinKey("pkg", 0, "one"), createImpressions(1, 2, 3));
+        byte[] bytes = encode(impressions);
+        bytes[bytes.length - 8] ^= 0x1;
+
+        try {
+            decode(bytes);
+            fail("Expected checksum failure");
+        } catch (IOException expected) {
+        }
+    }
+
+    @Test
+    public void testTruncated() throws Exception {
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(ImpressionsSnapshot.joinKey("pkg", 0, "one"), createImpressions(1, 2, 3));
+        byte[] bytes = encode(impressions);
+        byte[] truncated = new byte[bytes.length - 2];
+        System.arraycopy(bytes, 0, truncated, 0, truncated.length);
+
+        try {
+            decode(truncated);
+            fail("Expected truncated file to be rejected");
+        } catch (IOException expected) {
+        }
+    }
+
+    @Test
+    public void testRecordCountBeyondFile() throws Exception {
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(ImpressionsSnapshot.joinKey("pkg", 0, "one"), createImpressions(1, 2, 3));
+        byte[] bytes = encode(impressions);
+        // A header claiming more records than the file holds, with a checksum to match.
+        ByteBuffer buffer = ByteBuffer.wrap(bytes);
+        buffer.putInt(16, Integer.MAX_VALUE);
+        CRC32 crc = new CRC32();
+        crc.update(bytes, 0, bytes.length - Integer.BYTES);
+        buffer.putInt(bytes.length - Integer.BYTES, (int) crc.getValue());
+
+        try {
+            decode(bytes);
+            fail("Expected record count to be rejected");
+        } catch (IOException expected) {
+        }
+    }
+
+    @Test
+    public void testMappedLookup() throws Exception {
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        for (int i = 0; i < 50; i++) {
+            impressions.put(ImpressionsSnapshot.joinKey("pkg" + i, i % 3, "channel" + (i % 7)),
+                    createImpressions(i, i + 1, i + 2));
+        }
+        ImpressionsSnapshot.Mapped mapped =
+                new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(encode(impressions)));
+
+        assertEquals(50, mapped.size());
+        for (int i = 0; i < 50; i++) {
+            int record = mapped.find("pkg" + i, i % 3, "channel" + (i % 7));
+            assertEquals(i, mapped.getDismissals(record));
+            assertEquals(i + 1, mapped.getViews(record));
+            assertEquals(i + 2, mapped.getStreak(record));
+        }
+        assertEquals(-1, mapped.find("pkg1", 2, "channel1"));
+        assertEquals(-1, mapped.find("pkg1", 1, "channel2"));
+        assertEquals(-1, mapped.find("unknown", 1, "channel1"));
+    }
+
+    @Test
+    public void testMappedLookup_orderedByUtf8() throws Exception {
+        // U+FF21 sorts after U+1F600 in UTF-16 but before it in UTF-8.
+        String fullwidth = "\uFF21";
+        String emoji = "\uD83D\uDE00";
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(ImpressionsSnapshot.joinKey("pkg", 0, fullwidth),
+                createImpressions(1, 1, 1));
+        impressions.put(ImpressionsSnapshot.joinKey("pkg", 0, emoji), createImpressions(2, 2, 2));
+        ImpressionsSnapshot.Mapped mapped =
+                new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(encode(impressions)));
+
+        assertEquals(1, mapped.getViews(mapped.find("pkg", 0, fullwidth)));
+        assertEquals(2, mapped.getViews(mapped.find("pkg", 0, emoji)));
+        assertTrue(ImpressionsSnapshot.compareCodePoints(fullwidth, emoji) < 0);
+    }
+
+    @Test
+    public void testMappedChecksumMismatch() throws Exception {
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(ImpressionsSnapshot.joinKey("pkg", 0, "one"), createImpressions(1, 2, 3));
+        byte[] bytes = encode(impressions);
+        bytes[bytes.length - 8] ^= 0x1;
+
+        try {
+            new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(bytes));
+            fail("Expected checksum failure");
+        } catch (IOException expected) {
+        }
+    }
+
+    @Test
+    public void testWriteMergesBase() throws Exception {
+        String kept = ImpressionsSnapshot.joinKey("pkg", 0, "kept");
+        String changed = ImpressionsSnapshot.joinKey("pkg", 0, "changed");
+        ArrayMap<String, ChannelImpressions> old = new ArrayMap<>();
+        old.put(kept, createImpressions(1, 1, 1));
+        old.put(changed, createImpressions(2, 2, 2));
+        ImpressionsSnapshot.Mapped base =
+                new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(encode(old)));
+
+        ArrayMap<String, ChannelImpressions> touched = new ArrayMap<>();
+        touched.put(changed, createImpressions(3, 3, 0));
+        ByteArrayOutputStream out = new ByteArrayOutputStream();
+        ImpressionsSnapshot.write(out, toTable(touched), 1, base, null);
+
+        ArrayMap<String, ChannelImpressions> merged = decode(out.toByteArray());
+        assertEquals(2, merged.size());
+        assertEquals(createImpressions(1, 1, 1), merged.get(kept));
+        assertEquals(createImpressions(3, 3, 0), merged.get(changed));
+    }
+
+    @Test
+    public void testLastUpdatedRoundTrip() throws Exception {
+        String key = ImpressionsSnapshot.joinKey("pkg", 0, "one");
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        ChannelImpressions ci = createImpressions(1, 2, 3);
+        ci.setLastUpdatedMs(0x123456789abL);
+        impressions.put(key, ci);
+        byte[] bytes = encode(impressions);
+
+        assertEquals(0x123456789abL, decode(bytes).get(key).getLastUpdatedMs());
+        ImpressionsSnapshot.Mapped mapped = new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(bytes));
+        assertEquals(0x123456789abL, mapped.getLastUpdatedMs(mapped.find("pkg", 0, "one")));
+    }
+
+    @Test
+    public void testUnknownLastUpdatedIsMappingTime() throws Exception {
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(ImpressionsSnapshot.joinKey("pkg", 0, "one"), createImpressions(1, 2, 3));
+        byte[] bytes = encode(impressions);
+
+        long before = System.currentTimeMillis();
+        ImpressionsSnapshot.Mapped mapped = new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(bytes));
+        long lastUpdatedMs = mapped.getLastUpdatedMs(mapped.find("pkg", 0, "one"));
+        assertTrue(lastUpdatedMs >= before);
+        assertTrue(lastUpdatedMs <= System.currentTimeMillis());
+    }
+
+    @Test
+    public void testWriteFiltersRecords() throws Exception {
+        String dropped = ImpressionsSnapshot.joinKey("pkg", 0, "dropped");
+        String kept = ImpressionsSnapshot.joinKey("pkg", 0, "kept");
+        String droppedBase = ImpressionsSnapshot.joinKey("pkg", 0, "dropped.base");
+        ArrayMap<String, ChannelImpressions> old = new ArrayMap<>();
+        old.put(droppedBase, createImpressions(1, 1, 1));
+        ImpressionsSnapshot.Mapped base =
+                new ImpressionsSnapshot.Mapped(ByteBuffer.wrap(encode(old)));
+
+        ArrayMap<String, ChannelImpressions> impressions = new ArrayMap<>();
+        impressions.put(dropped, createImpressions(2, 2, 2));
+        impressions.put(kept, createImpressions(3, 3, 3));
+        ByteArrayOutputStream out = new ByteArrayOutputStream();
+        int count = ImpressionsSnapshot.write(out, toTable(impressions), 1, base,
+                (pkg, userId, channelId, lastUpdatedMs) -> channelId.startsWith("dropped"));
+
+        assertEquals(2, count);
+        ArrayMap<String, ChannelImpressions> written = decode(out.toByteArray());
+        assertEquals(1, written.size());
+        assertEquals(createImpressions(3, 3, 3), written.get(kept));
+    }
+
+    @Test
+    public void testSplitKey() {
+        String[] parts = ImpressionsSnapshot.splitKey("pkg|12|chan|nel");
+        assertEquals("pkg", parts[0]);
+        assertEquals("12", parts[1]);
+        assertEquals("chan|nel", parts[2]);
+
+        assertNull(ImpressionsSnapshot.splitKey("pkg|channel"));
+        assertNull(ImpressionsSnapshot.splitKey("pkg|user|channel"));
+    }
+}
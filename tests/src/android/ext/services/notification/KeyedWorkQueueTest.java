@@ -0,0 +1,279 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static junit.framework.Assert.assertFalse;
+import static junit.framework.Assert.assertTrue;
+
+import static org.junit.Assert.assertEquals;
+
+import org.junit.After;
+import org.junit.Test;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicLong;
+
+public class KeyedWorkQueueTest {
+    private static final long TIMEOUT_S = 5;
+
+    private KeyedWorkQueue mQueue;
+
+    @After
+    public void tearDown() {
+        if (mQueue != null) {
+            mQueue.shutdown();
+        }
+    }
+
+    @Test
+    public void testOrderedPerKey() throws Exception {
+        mQueue = new KeyedWorkQueue("test", 4, 100, 10_000);
+        List<Integer> order = new ArrayList<>();
+        CountDownLatch done = new CountDownLatch(1);
+        for (int i = 0; i < 20; i++) {
+            final int n = i;
+            mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {
+                synchronized (order) {
+                    order.add(n);
+                }
+            });
+        }
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, done::countDown);
+
+        assertTrue(done.await(TIMEOUT_S, TimeUnit.SECONDS));
+        for (int i = 0; i < 20; i++) {
+            assertEquals(i, (int) order.get(i));
+        }
+    }
+
+    @Test
+    public void testParallelAcrossKeys() throws Exception {
+        mQueue = new KeyedWorkQueue("test", 2, 100, 10_000);
+        CountDownLatch blocked = new CountDownLatch(1);
+        CountDownLatch other = new CountDownLatch(1);
+        mQueue.submit("one", KeyedWorkQueue.POLICY_RUN, () -> {
+            try {
+                blocked.await(TIMEOUT_S, TimeUnit.SECONDS);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        });
+        mQueue.submit("two", KeyedWorkQueue.POLICY_RUN, other::countDown);
+
+        // Work for another key is not held up by the blocked one.
+        assertTrue(other.await(TIMEOUT_S, TimeUnit.SECONDS));
+        blocked.countDown();
+    }
+
+    @Test
+    public void testRejectsWhenFull() throws Exception {
+        mQueue = new KeyedWorkQueue("test", 1, 2, 10_000);
+        CountDownLatch started = new CountDownLatch(1);
+        CountDownLatch release = new CountDownLatch(1);
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {
+            started.countDown();
+            try {
+                release.await(TIMEOUT_S, TimeUnit.SECONDS);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        });
+        assertTrue(started.await(TIMEOUT_S, TimeUnit.SECONDS));
+
+        assertTrue(mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {}));
+        assertTrue(mQueue.submit("other", KeyedWorkQueue.POLICY_RUN, () -> {}));
+        assertFalse(mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {}));
+
+        assertEquals(2, mQueue.getDepth());
+        assertEquals(2, mQueue.getMaxDepth());
+        assertEquals(1, mQueue.getRejectedCount());
+        release.countDown();
+    }
+
+    @Test
+    public void testLatestReplacesPendingWhenFull() throws Exception {
+        mQueue = new KeyedWorkQueue("test", 1, 2, 10_000);
+        CountDownLatch started = new CountDownLatch(1);
+        CountDownLatch release = new CountDownLatch(1);
+        CountDownLatch done = new CountDownLatch(1);
+        List<Integer> ran = new ArrayList<>();
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {
+            started.countDown();
+            try {
+                release.await(TIMEOUT_S, TimeUnit.SECONDS);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        });
+        assertTrue(started.await(TIMEOUT_S, TimeUnit.SECONDS));
+        assertTrue(mQueue.submit("key", KeyedWorkQueue.POLICY_LATEST, () -> {
+            synchronized (ran) {
+                ran.add(0);
+            }
+        }));
+        assertTrue(mQueue.submit("other", KeyedWorkQueue.POLICY_RUN, () -> {}));
+
+        // The queue is full, but the new version replaces the pending one for the same key.
+        assertTrue(mQueue.submit("key", KeyedWorkQueue.POLICY_LATEST, () -> {
+            synchronized (ran) {
+                ran.add(1);
+            }
+            done.countDown();
+        }));
+        assertEquals(2, mQueue.getDepth());
+        assertEquals(0, mQueue.getRejectedCount());
+        release.countDown();
+
+        assertTrue(done.await(TIMEOUT_S, TimeUnit.SECONDS));
+        synchronized (ran) {
+            assertEquals(1, ran.size());
+            assertEquals(1, (int) ran.get(0));
+        }
+        assertEquals(1, mQueue.getSupersededCount());
+    }
+
+    @Test
+    public void testDropsStaleWork() throws Exception {
+        AtomicLong clock = new AtomicLong();
+        mQueue = new KeyedWorkQueue("test", 1, 10, 10, clock::get);
+        CountDownLatch release = new CountDownLatch(1);
+        CountDownLatch done = new CountDownLatch(1);
+        boolean[] ran = new boolean[2];
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {
+            try {
+                release.await(TIMEOUT_S, TimeUnit.SECONDS);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        });
+        mQueue.submit("key", KeyedWorkQueue.POLICY_DROP_IF_STALE, () -> ran[0] = true);
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {
+            ran[1] = true;
+            done.countDown();
+        });
+        clock.set(50);
+        release.countDown();
+
+        assertTrue(done.await(TIMEOUT_S, TimeUnit.SECONDS));
+        assertFalse(ran[0]);
+        assertTrue(ran[1]);
+        assertEquals(1, mQueue.getDroppedStaleCount());
+        assertEquals(3, mQueue.getSubmittedCount());
+        assertEquals(50, mQueue.getLongestWaitMs());
+    }
+
+    @Test
+    public void testLatestSupersedesPending() throws Exception {
+        mQueue = new KeyedWorkQueue("test", 1, 10, 10_000);
+        CountDownLatch release = new CountDownLatch(1);
+        CountDownLatch done = new CountDownLatch(1);
+        List<Integer> ran = new ArrayList<>();
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {
+            try {
+                release.await(TIMEOUT_S, TimeUnit.SECONDS);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        });
+        for (int i = 0; i < 3; i++) {
+            final int n = i;
+            mQueue.submit("key", KeyedWorkQueue.POLICY_LATEST, () -> {
+                synchronized (ran) {
+                    ran.add(n);
+                }
+            });
+        }
+        assertTrue(mQueue.hasPending("key", KeyedWorkQueue.POLICY_LATEST));
+        assertFalse(mQueue.hasPending("other", KeyedWorkQueue.POLICY_LATEST));
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, done::countDown);
+        release.countDown();
+
+        assertTrue(done.await(TIMEOUT_S, TimeUnit.SECONDS));
+        synchronized (ran) {
+            assertEquals(1, ran.size());
+            assertEquals(2, (int) ran.get(0));
+        }
+        assertEquals(2, mQueue.getSupersededCount());
+    }
+
+    @Test
+    public void testCancel() throws Exception {
+        mQueue = new KeyedWorkQueue("test", 1, 10, 10_000);
+        CountDownLatch release = new CountDownLatch(1);
+        CountDownLatch done = new CountDownLatch(1);
+        boolean[] ran = new boolean[1];
+        mQueue.submit("blocker", KeyedWorkQueue.POLICY_RUN, () -> {
+            try {
+                release.await(TIMEOUT_S, TimeUnit.SECONDS);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        });
+        mQueue.submit("key", KeyedWorkQueue.POLICY_LATEST, () -> ran[0] = true);
+
+        assertEquals(1, mQueue.cancel("key", KeyedWorkQueue.POLICY_LATEST));
+        assertEquals(0, mQueue.getDepth());
+        // The emptied lane still accepts work once it gets to run.
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, done::countDown);
+        release.countDown();
+
+        assertTrue(done.await(TIMEOUT_S, TimeUnit.SECONDS));
+        assertFalse(ran[0]);
+        assertEquals(1, mQueue.getCancelledCount());
+    }
+
+    @Test
+    public void testRejectsAfterShutdown() {
+        mQueue = new KeyedWorkQueue("test", 1, 10, 10_000);
+        mQueue.shutdown();
+
+        assertFalse(mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {}));
+    }
+
+    @Test
+    public void testDrainRunsPendingWork() throws Exception {
+        mQueue = new KeyedWorkQueue("test", 1, 10, 10_000);
+        CountDownLatch started = new CountDownLatch(1);
+        List<Integer> ran = new ArrayList<>();
+        mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {
+            started.countDown();
+            try {
+                Thread.sleep(50);
+            } catch (InterruptedException e) {
+                Thread.currentThread().interrupt();
+            }
+        });
+        for (int i = 0; i < 3; i++) {
+            final int n = i;
+            mQueue.submit(i == 1 ? "other" : "key", KeyedWorkQueue.POLICY_RUN, () -> {
+                synchronized (ran) {
+                    ran.add(n);
+                }
+            });
+        }
+        assertTrue(started.await(TIMEOUT_S, TimeUnit.SECONDS));
+
+        assertTrue(mQueue.drainAndShutdown(TimeUnit.SECONDS.toMillis(TIMEOUT_S)));
+        synchronized (ran) {
+            assertEquals(3, ran.size());
+        }
+        assertFalse(mQueue.submit("key", KeyedWorkQueue.POLICY_RUN, () -> {}));
+    }
+}
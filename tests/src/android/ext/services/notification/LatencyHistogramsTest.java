@@ -0,0 +1,78 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static android.ext.services.notification.LatencyHistograms.STAGE_DELIVER;
+import static android.ext.services.notification.LatencyHistograms.STAGE_SUGGEST;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertTrue;
+
+import org.junit.Test;
+
+public class LatencyHistogramsTest {
+    private static final long WINDOW_MS = 1000;
+
+    @Test
+    public void testBucketsAreLogLinear() {
+        for (long micros = 0; micros < 1_000_000; micros += 7) {
+            int bucket = LatencyHistograms.bucketOf(micros);
+            assertTrue(LatencyHistograms.lowerBoundOf(bucket) <= micros);
+            assertTrue(micros < LatencyHistograms.lowerBoundOf(bucket + 1));
+            // No bucket is wider than a quarter of the durations it holds.
+            long width = LatencyHistograms.lowerBoundOf(bucket + 1)
+                    - LatencyHistograms.lowerBoundOf(bucket);
+            assertTrue(width <= Math.max(1, LatencyHistograms.lowerBoundOf(bucket) / 4));
+        }
+    }
+
+    @Test
+    public void testLongDurationsGoToLastBucket() {
+        assertEquals(LatencyHistograms.BUCKET_COUNT - 1,
+                LatencyHistograms.bucketOf(Long.MAX_VALUE));
+    }
+
+    @Test
+    public void testPercentiles() {
+        LatencyHistograms latencies = new LatencyHistograms(WINDOW_MS);
+        for (int i = 0; i < 90; i++) {
+            latencies.record(STAGE_SUGGEST, 100, 0);
+        }
+        for (int i = 0; i < 10; i++) {
+            latencies.record(STAGE_SUGGEST, 10_000, 0);
+        }
+
+        long p50 = latencies.getPercentileMicros(STAGE_SUGGEST, 50, 0);
+        long p99 = latencies.getPercentileMicros(STAGE_SUGGEST, 99, 0);
+        assertTrue(p50 >= 100 && p50 < 125);
+        assertTrue(p99 >= 10_000 && p99 < 12_500);
+        assertEquals(-1, latencies.getPercentileMicros(STAGE_DELIVER, 50, 0));
+        assertEquals(100, latencies.getTotalCount(STAGE_SUGGEST));
+    }
+
+    @Test
+    public void testOldWindowsFallOutOfTheRing() {
+        LatencyHistograms latencies = new LatencyHistograms(WINDOW_MS);
+        latencies.record(STAGE_SUGGEST, 10_000, 0);
+        long later = 20 * WINDOW_MS;
+        latencies.record(STAGE_SUGGEST, 100, later);
+
+        long p99 = latencies.getPercentileMicros(STAGE_SUGGEST, 99, later);
+        assertTrue(p99 < 125);
+        assertEquals(2, latencies.getTotalCount(STAGE_SUGGEST));
+    }
+}
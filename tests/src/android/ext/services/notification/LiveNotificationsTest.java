@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static android.app.NotificationManager.IMPORTANCE_HIGH;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertFalse;
+import static org.junit.Assert.assertNull;
+import static org.junit.Assert.assertSame;
+import static org.junit.Assert.assertTrue;
+import static org.mockito.ArgumentMatchers.anyInt;
+import static org.mockito.ArgumentMatchers.anyString;
+import static org.mockito.Mockito.when;
+
+import android.app.Notification;
+import android.app.NotificationChannel;
+import android.content.pm.ApplicationInfo;
+import android.content.pm.IPackageManager;
+import android.os.Build;
+import android.os.Process;
+import android.os.UserHandle;
+import android.service.notification.StatusBarNotification;
+import android.testing.TestableContext;
+
+import org.junit.Before;
+import org.junit.Rule;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.mockito.Mock;
+import org.mockito.MockitoAnnotations;
+
+import androidx.test.InstrumentationRegistry;
+import androidx.test.runner.AndroidJUnit4;
+
+@RunWith(AndroidJUnit4.class)
+public class LiveNotificationsTest {
+    @Mock
+    private IPackageManager mPackageManager;
+    @Mock
+    private SmsHelper mSmsHelper;
+
+    @Rule
+    public final TestableContext mContext =
+            new TestableContext(InstrumentationRegistry.getContext(), null);
+
+    private final NotificationChannel mChannel =
+            new NotificationChannel("channel", "", IMPORTANCE_HIGH);
+
+    @Before
+    public void setUp() throws Exception {
+        MockitoAnnotations.initMocks(this);
+        ApplicationInfo info = new ApplicationInfo();
+        info.targetSdkVersion = Build.VERSION_CODES.P;
+        when(mPackageManager.getApplicationInfo(anyString(), anyInt(), anyInt()))
+                .thenReturn(info);
+    }
+
+    private NotificationEntry createEntry(String tag, String text) {
+        Notification n = new Notification.Builder(mContext, mChannel.getId())
+                .setContentTitle("foo")
+                .setContentText(text)
+                .build();
+        String pkg = mContext.getPackageName();
+        int uid = Process.myUid();
+        StatusBarNotification sbn = new StatusBarNotification(
+                pkg, pkg, 0, tag, uid, uid, n, UserHandle.SYSTEM, null, 0);
+        return new NotificationEntry(mContext, mPackageManager, sbn, mChannel, mSmsHelper);
+    }
+
+    @Test
+    public void testPutAndRemove() {
+        LiveNotifications live = new LiveNotifications(Long.MAX_VALUE);
+        NotificationEntry entry = createEntry("tag", "text");
+        String key = entry.getSbn().getKey();
+
+        live.put(entry);
+        assertSame(entry, live.get(key));
+        assertEquals(LiveNotifications.estimateBytes(entry), live.getBytes());
+
+        assertSame(entry, live.remove(key));
+        assertFalse(live.containsKey(key));
+        assertNull(live.remove(key));
+        assertEquals(0, live.getBytes());
+    }
+
+    @Test
+    public void testRepostIsChargedOnce() {
+        LiveNotifications live = new LiveNotifications(Long.MAX_VALUE);
+        live.put(createEntry("tag", "text"));
+        NotificationEntry update = createEntry("tag", "longer text");
+        live.put(update);
+
+        assertEquals(1, live.size());
+        assertEquals(LiveNotifications.estimateBytes(update), live.getBytes());
+    }
+
+    @Test
+    public void testEstimateGrowsWithContent() {
+        assertTrue(LiveNotifications.estimateBytes(createEntry("tag", "a much longer text"))
+                > LiveNotifications.estimateBytes(createEntry("tag", "text")));
+    }
+
+    @Test
+    public void testOldestIsDroppedOverCap() {
+        NotificationEntry first = createEntry("first", "text");
+        NotificationEntry second = createEntry("second", "text");
+        NotificationEntry third = createEntry("third", "text");
+        LiveNotifications live = new LiveNotifications(
+                LiveNotifications.estimateBytes(first) + LiveNotifications.estimateBytes(second));
+
+        live.put(first);
+        live.put(second);
+        live.put(third);
+
+        assertFalse(live.containsKey(first.getSbn().getKey()));
+        assertTrue(live.containsKey(second.getSbn().getKey()));
+        assertTrue(live.containsKey(third.getSbn().getKey()));
+        assertEquals(1, live.getEvictionCount());
+    }
+
+    @Test
+    public void testLatestIsKeptOverCap() {
+        LiveNotifications live = new LiveNotifications(1);
+        live.put(createEntry("first", "text"));
+        NotificationEntry second = createEntry("second", "text");
+        live.put(second);
+
+        assertEquals(1, live.size());
+        assertTrue(live.containsKey(second.getSbn().getKey()));
+    }
+
+    @Test
+    public void testLoweringCapTrims() {
+        LiveNotifications live = new LiveNotifications(Long.MAX_VALUE);
+        live.put(createEntry("first", "text"));
+        live.put(createEntry("second", "text"));
+
+        live.setMaxBytes(0);
+
+        assertEquals(1, live.size());
+        assertEquals(1, live.getEvictionCount());
+    }
+}
@@ -0,0 +1,108 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertNotNull;
+import static org.junit.Assert.assertNull;
+import static org.junit.Assert.assertSame;
+
+import android.app.Notification;
+import android.app.Person;
+import android.view.textclassifier.ConversationActions;
+
+import org.junit.Test;
+
+import java.util.Arrays;
+
+public class MessageWindowCacheTest {
+    private static final Person SENDER =
+            new Person.Builder().setName("sender").setKey("sender").build();
+
+    private final MessageWindowCache mCache = new MessageWindowCache(2);
+
+    private static MessageWindowCache.Window window(MessageWindowCache.Item... items) {
+        return new MessageWindowCache.Window(null, Arrays.asList(items));
+    }
+
+    private static Notification.MessagingStyle.Message posted(
+            long time, String text, Person sender) {
+        return new Notification.MessagingStyle.Message(text, time, sender);
+    }
+
+    private static MessageWindowCache.Item item(long time, String text) {
+        return new MessageWindowCache.Item(posted(time, text, SENDER),
+                new ConversationActions.Message.Builder(SENDER)
+                        .setText(text)
+                        .build());
+    }
+
+    @Test
+    public void testFindMatchesTimeTextAndSender() {
+        MessageWindowCache.Item item = item(1000, "hello");
+        MessageWindowCache.Window window = window(item(2000, "hi"), item);
+
+        assertSame(item, window.find(posted(1000, "hello", SENDER)));
+        assertNull(window.find(posted(1001, "hello", SENDER)));
+        assertNull(window.find(posted(1000, "hellp", SENDER)));
+        assertNull(window.find(posted(1000, "hello", null)));
+        assertNull(window.find(posted(1000, "hello",
+                new Person.Builder().setName("other").setKey("sender").build())));
+    }
+
+    @Test
+    public void testSenderWithSameNameDoesNotMatch() {
+        MessageWindowCache.Window window = window(item(1000, "hello"));
+
+        assertNull(window.find(posted(1000, "hello",
+                new Person.Builder().setName("sender").setKey("namesake").build())));
+        assertNull(window.find(posted(1000, "hello",
+                new Person.Builder().setName("sender").setKey("sender")
+                        .setUri("tel:1234").build())));
+    }
+
+    @Test
+    public void testCounts() {
+        mCache.put("a", window(item(1000, "hello")), 1, 0);
+        mCache.put("a", window(item(2000, "hi"), item(1000, "hello")), 1, 1);
+
+        assertEquals(2, mCache.getConvertedCount());
+        assertEquals(1, mCache.getReusedCount());
+        assertEquals(2, mCache.get("a").items.size());
+    }
+
+    @Test
+    public void testLeastRecentlyUsedIsDropped() {
+        mCache.put("a", window(), 0, 0);
+        mCache.put("b", window(), 0, 0);
+        mCache.get("a");
+        mCache.put("c", window(), 0, 0);
+
+        assertNotNull(mCache.get("a"));
+        assertNull(mCache.get("b"));
+        assertNotNull(mCache.get("c"));
+    }
+
+    @Test
+    public void testRemove() {
+        mCache.put("a", window(), 0, 0);
+        mCache.remove("a");
+
+        assertNull(mCache.get("a"));
+        assertEquals(0, mCache.size());
+    }
+}
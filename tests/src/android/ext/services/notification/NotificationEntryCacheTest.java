@@ -0,0 +1,138 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static android.app.NotificationManager.IMPORTANCE_HIGH;
+import static android.app.NotificationManager.IMPORTANCE_LOW;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertNull;
+import static org.junit.Assert.assertSame;
+import static org.mockito.ArgumentMatchers.anyInt;
+import static org.mockito.ArgumentMatchers.anyString;
+import static org.mockito.Mockito.when;
+
+import android.app.Notification;
+import android.app.NotificationChannel;
+import android.content.pm.ApplicationInfo;
+import android.content.pm.IPackageManager;
+import android.os.Build;
+import android.os.Process;
+import android.os.UserHandle;
+import android.service.notification.StatusBarNotification;
+import android.testing.TestableContext;
+
+import org.junit.Before;
+import org.junit.Rule;
+import org.junit.Test;
+import org.junit.runner.RunWith;
+import org.mockito.Mock;
+import org.mockito.MockitoAnnotations;
+
+import androidx.test.InstrumentationRegistry;
+import androidx.test.runner.AndroidJUnit4;
+
+@RunWith(AndroidJUnit4.class)
+public class NotificationEntryCacheTest {
+    @Mock
+    private IPackageManager mPackageManager;
+    @Mock
+    private SmsHelper mSmsHelper;
+
+    @Rule
+    public final TestableContext mContext =
+            new TestableContext(InstrumentationRegistry.getContext(), null);
+
+    private final NotificationChannel mChannel =
+            new NotificationChannel("channel", "", IMPORTANCE_HIGH);
+    private final NotificationEntryCache mCache = new NotificationEntryCache(2);
+
+    @Before
+    public void setUp() throws Exception {
+        MockitoAnnotations.initMocks(this);
+        ApplicationInfo info = new ApplicationInfo();
+        info.targetSdkVersion = Build.VERSION_CODES.P;
+        when(mPackageManager.getApplicationInfo(anyString(), anyInt(), anyInt()))
+                .thenReturn(info);
+    }
+
+    private StatusBarNotification generateSbn(String tag, long postTime) {
+        Notification n = new Notification.Builder(mContext, mChannel.getId())
+                .setContentTitle("foo")
+                .build();
+        String pkg = mContext.getPackageName();
+        int uid = Process.myUid();
+        return new StatusBarNotification(pkg, pkg, 0, tag, uid, uid, n, UserHandle.SYSTEM, null,
+                postTime);
+    }
+
+    private NotificationEntry createEntry(StatusBarNotification sbn) {
+        return new NotificationEntry(mContext, mPackageManager, sbn, mChannel, mSmsHelper);
+    }
+
+    @Test
+    public void testTakeMatchingEntry() {
+        StatusBarNotification sbn = generateSbn("tag", 100);
+        NotificationEntry entry = createEntry(sbn);
+        mCache.put(entry);
+
+        assertSame(entry, mCache.take(sbn, mChannel));
+        // Handed over only once.
+        assertNull(mCache.take(sbn, mChannel));
+        assertEquals(1, mCache.getHitCount());
+        assertEquals(1, mCache.getMissCount());
+    }
+
+    @Test
+    public void testNewerVersionIsNotMatched() {
+        mCache.put(createEntry(generateSbn("tag", 100)));
+
+        assertNull(mCache.take(generateSbn("tag", 200), mChannel));
+    }
+
+    @Test
+    public void testChangedChannelIsNotMatched() {
+        StatusBarNotification sbn = generateSbn("tag", 100);
+        mCache.put(createEntry(sbn));
+        NotificationChannel changed = new NotificationChannel("channel", "", IMPORTANCE_LOW);
+
+        assertNull(mCache.take(sbn, changed));
+    }
+
+    @Test
+    public void testOldestIsEvicted() {
+        StatusBarNotification first = generateSbn("first", 100);
+        StatusBarNotification second = generateSbn("second", 100);
+        StatusBarNotification third = generateSbn("third", 100);
+        mCache.put(createEntry(first));
+        mCache.put(createEntry(second));
+        mCache.put(createEntry(third));
+
+        assertNull(mCache.take(first, mChannel));
+        assertEquals(1, mCache.getEvictionCount());
+        assertEquals(second.getKey(), mCache.take(second, mChannel).getSbn().getKey());
+    }
+
+    @Test
+    public void testRemove() {
+        StatusBarNotification sbn = generateSbn("tag", 100);
+        mCache.put(createEntry(sbn));
+        mCache.remove(sbn.getKey());
+
+        assertNull(mCache.take(sbn, mChannel));
+    }
+}
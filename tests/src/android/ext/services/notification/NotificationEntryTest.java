@@ -24,6 +24,8 @@ import static android.media.AudioAttributes.USAGE_ALARM;
 import static junit.framework.Assert.assertFalse;
 import static junit.framework.Assert.assertTrue;
 
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertNotNull;
 import static org.junit.Assert.assertNull;
 import static org.mockito.ArgumentMatchers.anyInt;
 import static org.mockito.ArgumentMatchers.anyString;
@@ -31,8 +33,11 @@ import static org.mockito.Mockito.when;
 
 import android.app.Notification;
 import android.app.NotificationChannel;
+import android.app.PendingIntent;
 import android.app.Person;
+import android.app.RemoteInput;
 import android.content.ComponentName;
+import android.content.Intent;
 import android.content.pm.ApplicationInfo;
 import android.content.pm.IPackageManager;
 import android.graphics.Bitmap;
@@ -148,6 +153,59 @@ public class NotificationEntryTest {
         assertFalse(entry.involvesPeople());
     }
 
+    @Test
+    public void testDefaultSmsAppIsCheckedEachTime() {
+        NotificationChannel channel = new NotificationChannel("", "", IMPORTANCE_HIGH);
+        StatusBarNotification sbn = generateSbn(channel.getId(), DEFAULT_SMS_PACKAGE_NAME);
+        NotificationEntry entry = new NotificationEntry(
+                mContext, mPackageManager, sbn, channel, mSmsHelper);
+        assertTrue(entry.involvesPeople());
+
+        when(mSmsHelper.getDefaultSmsApplication())
+                .thenReturn(new ComponentName("other", "bar"));
+        assertFalse(entry.involvesPeople());
+    }
+
+    @Test
+    public void testHasInlineReply() {
+        NotificationChannel channel = new NotificationChannel("", "", IMPORTANCE_HIGH);
+        PendingIntent intent = PendingIntent.getActivity(mContext, 0, new Intent(), 0);
+        Notification n = new Notification.Builder(mContext, channel.getId())
+                .addAction(new Notification.Action.Builder(null, "reply", intent)
+                        .addRemoteInput(new RemoteInput.Builder("text").build())
+                        .build())
+                .build();
+        NotificationEntry entry = new NotificationEntry(
+                mContext, mPackageManager, generateSbn(n), channel, mSmsHelper);
+
+        assertTrue(entry.hasInlineReply());
+    }
+
+    @Test
+    public void testHasNoInlineReply() {
+        NotificationChannel channel = new NotificationChannel("", "", IMPORTANCE_HIGH);
+        NotificationEntry entry = new NotificationEntry(
+                mContext, mPackageManager, generateSbn(channel.getId()), channel, mSmsHelper);
+
+        assertFalse(entry.hasInlineReply());
+    }
+
+    @Test
+    public void testStateIsSetOnce() {
+        NotificationChannel channel = new NotificationChannel("", "", IMPORTANCE_HIGH);
+        NotificationEntry entry = new NotificationEntry(
+                mContext, mPackageManager, generateSbn(channel.getId()), channel, mSmsHelper);
+        assertFalse(entry.hasSeen());
+        assertFalse(entry.isShowActionEventLogged());
+
+        assertTrue(entry.setShowActionEventLogged());
+        assertFalse(entry.setShowActionEventLogged());
+        entry.setSeen();
+
+        assertTrue(entry.hasSeen());
+        assertTrue(entry.isShowActionEventLogged());
+    }
+
     @Test
     public void testIsInboxStyle() {
         NotificationChannel channel = new NotificationChannel("", "", IMPORTANCE_HIGH);
@@ -263,4 +321,25 @@ public class NotificationEntryTest {
         assertNull(entry.getNotification().largeIcon);
         assertNull(entry.getNotification().extras.getParcelable(Notification.EXTRA_LARGE_ICON));
     }
+
+    @Test
+    public void testShrinkNotificationKeepsWhatIsRead() {
+        Person sender = new Person.Builder().setName("sender").build();
+        Notification n = new Notification.Builder(mContext, "")
+                .setCategory(Notification.CATEGORY_MESSAGE)
+                .setStyle(new Notification.MessagingStyle(sender)
+                        .addMessage("hello", 1, sender))
+                .build();
+        n.extras.putParcelable("unread", Bitmap.createBitmap(1, 1, Bitmap.Config.RGB_565));
+        NotificationChannel channel = new NotificationChannel("", "", IMPORTANCE_HIGH);
+
+        NotificationEntry entry = new NotificationEntry(
+                mContext, mPackageManager, generateSbn(n), channel, mSmsHelper);
+
+        Notification light = entry.getNotification();
+        assertTrue(entry.isMessaging());
+        assertEquals(1, light.extras.getParcelableArray(Notification.EXTRA_MESSAGES).length);
+        assertNotNull(light.extras.getParcelable(Notification.EXTRA_MESSAGING_PERSON));
+        assertNull(light.extras.getParcelable("unread"));
+    }
 }
@@ -0,0 +1,108 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertNotNull;
+import static org.junit.Assert.assertNull;
+
+import org.junit.Test;
+
+public class SessionStoreTest {
+    private int mLiveNotifications;
+    private final SessionStore mStore = new SessionStore(() -> mLiveNotifications);
+
+    private static SessionStore.Session session(String resultId) {
+        return new SessionStore.Session(resultId,
+                new CharSequence[] {"yes", "no"}, new float[] {0.6f, 0.3f});
+    }
+
+    @Test
+    public void testReplyScore() {
+        SessionStore.Session session = session("id");
+
+        assertEquals(0.6f, session.getReplyScore("yes"), 0f);
+        assertEquals(0.3f, session.getReplyScore(new StringBuilder("no")), 0f);
+        assertEquals(0f, session.getReplyScore("maybe"), 0f);
+    }
+
+    @Test
+    public void testGrowsWithLiveNotifications() {
+        mLiveNotifications = SessionStore.MIN_CAPACITY * 2;
+        for (int i = 0; i < mLiveNotifications; i++) {
+            mStore.put("key" + i, session("id" + i));
+        }
+
+        assertNotNull(mStore.get("key0"));
+        assertEquals(mLiveNotifications, mStore.size());
+        assertEquals(0, mStore.getEvictionCount());
+    }
+
+    @Test
+    public void testOldestIsEvictedOverCapacity() {
+        for (int i = 0; i <= SessionStore.MIN_CAPACITY; i++) {
+            mStore.put("key" + i, session("id" + i));
+        }
+
+        assertNull(mStore.get("key0"));
+        assertNotNull(mStore.get("key1"));
+        assertEquals(1, mStore.getEvictionCount());
+        assertEquals(1, mStore.getHitCount());
+        assertEquals(1, mStore.getMissCount());
+    }
+
+    @Test
+    public void testRemoveEndsSession() {
+        mStore.put("key", session("id"));
+        mStore.remove("key", mStore.onNotificationRemoved("key"));
+
+        assertNull(mStore.get("key"));
+        assertEquals(0, mStore.getEvictionCount());
+    }
+
+    @Test
+    public void testRemoveOnlyEndsSessionOfRemovedNotification() {
+        mStore.put("key", session("old"));
+        SessionStore.Session removed = mStore.onNotificationRemoved("key");
+        Object token = mStore.startSuggesting("key");
+        mStore.finishSuggesting("key", token, session("new"));
+
+        mStore.remove("key", removed);
+
+        assertEquals("new", mStore.get("key").resultId);
+    }
+
+    @Test
+    public void testSuggestionsForRemovedNotificationAreNotStored() {
+        Object token = mStore.startSuggesting("key");
+        mStore.onNotificationRemoved("key");
+        mStore.finishSuggesting("key", token, session("id"));
+
+        assertNull(mStore.get("key"));
+        assertEquals(0, mStore.size());
+    }
+
+    @Test
+    public void testOnlyLatestSuggestionsAreStored() {
+        Object first = mStore.startSuggesting("key");
+        Object second = mStore.startSuggesting("key");
+        mStore.finishSuggesting("key", second, session("second"));
+        mStore.finishSuggesting("key", first, session("first"));
+
+        assertEquals("second", mStore.get("key").resultId);
+    }
+}
@@ -65,6 +65,7 @@ import java.util.Arrays;
 import java.util.Collections;
 import java.util.List;
 import java.util.Objects;
+import java.util.concurrent.CountDownLatch;
 
 import javax.annotation.Nullable;
 
@@ -274,6 +275,65 @@ public class SmartActionsHelperTest {
                 .containsExactly(ConversationAction.TYPE_TEXT_REPLY);
     }
 
+    @Test
+    public void testSuggest_repostOnlyConvertsNewMessages() {
+        Person me = new Person.Builder().setName("Me").build();
+        Person userA = new Person.Builder().setName("A").build();
+        Notification.MessagingStyle style =
+                new Notification.MessagingStyle(me)
+                        .addMessage("firstMessage", 1000, userA)
+                        .addMessage("secondMessage", 2000, me)
+                        .addMessage("thirdMessage", 3000, userA);
+        setStatusBarNotification(mNotificationBuilder
+                .setStyle(style)
+                .setActions(createReplyAction())
+                .build());
+        mSmartActionsHelper.suggest(createNotificationEntry());
+
+        style.addMessage("fourthMessage", 4000, userA);
+        setStatusBarNotification(mNotificationBuilder.setStyle(style).build());
+        mSmartActionsHelper.suggest(createNotificationEntry());
+
+        MessageWindowCache windows = mSmartActionsHelper.getMessageWindows();
+        assertThat(windows.getConvertedCount()).isEqualTo(4);
+        assertThat(windows.getReusedCount()).isEqualTo(3);
+        ArgumentCaptor<ConversationActions.Request> argumentCaptor =
+                ArgumentCaptor.forClass(ConversationActions.Request.class);
+        verify(mTextClassifier, times(2)).suggestConversationActions(argumentCaptor.capture());
+        List<ConversationActions.Message> messages = argumentCaptor.getValue().getConversation();
+        assertThat(messages).hasSize(4);
+        MessageSubject.assertThat(messages.get(1))
+                .hasPerson(ConversationActions.Message.PERSON_USER_SELF);
+        MessageSubject.assertThat(messages.get(3)).hasText("fourthMessage");
+
+        mSmartActionsHelper.onNotificationRemoved(mStatusBarNotification.getKey());
+        assertThat(windows.size()).isEqualTo(0);
+    }
+
+    @Test
+    public void testSuggest_repostDoesNotReuseMessageOfNamesake() {
+        Person me = new Person.Builder().setName("Me").build();
+        Person alex = new Person.Builder().setName("Alex").setKey("alex1").build();
+        Person otherAlex = new Person.Builder().setName("Alex").setKey("alex2").build();
+        setStatusBarNotification(mNotificationBuilder
+                .setStyle(new Notification.MessagingStyle(me).addMessage("hi", 1000, alex))
+                .setActions(createReplyAction())
+                .build());
+        mSmartActionsHelper.suggest(createNotificationEntry());
+
+        setStatusBarNotification(mNotificationBuilder
+                .setStyle(new Notification.MessagingStyle(me).addMessage("hi", 1000, otherAlex))
+                .build());
+        mSmartActionsHelper.suggest(createNotificationEntry());
+
+        assertThat(mSmartActionsHelper.getMessageWindows().getReusedCount()).isEqualTo(0);
+        ArgumentCaptor<ConversationActions.Request> argumentCaptor =
+                ArgumentCaptor.forClass(ConversationActions.Request.class);
+        verify(mTextClassifier, times(2)).suggestConversationActions(argumentCaptor.capture());
+        MessageSubject.assertThat(argumentCaptor.getValue().getConversation().get(0))
+                .hasPerson(otherAlex);
+    }
+
     @Test
     public void testSuggest_lastMessageLocalUser() {
         Person me = new Person.Builder().setName("Me").build();
@@ -362,6 +422,40 @@ public class SmartActionsHelperTest {
         verify(mTextClassifier, never()).onTextClassifierEvent(any(TextClassifierEvent.class));
     }
 
+    @Test
+    public void testSessionEndsWhenNotificationIsRemoved() {
+        Notification notification = createMessageNotification();
+        setStatusBarNotification(notification);
+
+        String key = mStatusBarNotification.getKey();
+
+        mSmartActionsHelper.suggest(createNotificationEntry());
+        SessionStore.Session session = mSmartActionsHelper.onNotificationRemoved(key);
+        mSmartActionsHelper.endSession(key, session);
+        mSmartActionsHelper.onNotificationDirectReplied(key);
+
+        verify(mTextClassifier, never()).onTextClassifierEvent(
+                argThat(new TextClassifierEventMatcher(TextClassifierEvent.TYPE_MANUAL_REPLY)));
+        assertThat(mSmartActionsHelper.getSessions().size()).isEqualTo(0);
+    }
+
+    @Test
+    public void testLateRemovalKeepsSessionOfRepost() {
+        Notification notification = createMessageNotification();
+        setStatusBarNotification(notification);
+        String key = mStatusBarNotification.getKey();
+
+        mSmartActionsHelper.suggest(createNotificationEntry());
+        SessionStore.Session session = mSmartActionsHelper.onNotificationRemoved(key);
+        // Re-posted before the removal got to end the session.
+        mSmartActionsHelper.suggest(createNotificationEntry());
+        mSmartActionsHelper.endSession(key, session);
+        mSmartActionsHelper.onNotificationDirectReplied(key);
+
+        verify(mTextClassifier, times(1)).onTextClassifierEvent(
+                argThat(new TextClassifierEventMatcher(TextClassifierEvent.TYPE_MANUAL_REPLY)));
+    }
+
     @Test
     public void testOnNotificationDirectReply() {
         Notification notification = createMessageNotification();
@@ -422,6 +516,49 @@ public class SmartActionsHelperTest {
         assertTextClassifierEvent(events.get(1), TextClassifierEvent.TYPE_ACTIONS_SHOWN);
     }
 
+    @Test
+    public void testSuggest_identicalRepostIsNotClassifiedAgain() {
+        Notification notification = createMessageNotification();
+        setStatusBarNotification(notification);
+
+        SmartActionsHelper.SmartSuggestions first =
+                mSmartActionsHelper.suggest(createNotificationEntry());
+        SmartActionsHelper.SmartSuggestions second =
+                mSmartActionsHelper.suggest(createNotificationEntry());
+
+        verify(mTextClassifier, times(1))
+                .suggestConversationActions(any(ConversationActions.Request.class));
+        verify(mTextClassifier, times(1)).onTextClassifierEvent(
+                argThat(new TextClassifierEventMatcher(
+                        TextClassifierEvent.TYPE_ACTIONS_GENERATED)));
+        assertThat(second.replies).isEqualTo(first.replies);
+        assertThat(mSmartActionsHelper.getResultCache().getHitCount()).isEqualTo(1);
+    }
+
+    @Test
+    public void testSuggest_classifierMissesDeadline() throws Exception {
+        CountDownLatch release = new CountDownLatch(1);
+        when(mTextClassifier.suggestConversationActions(any(ConversationActions.Request.class)))
+                .thenAnswer(invocation -> {
+                    release.await();
+                    return new ConversationActions(Arrays.asList(REPLY_ACTION), RESULT_ID);
+                });
+        mSettings.mSuggestDeadlineMs = 50;
+        Notification notification = createMessageNotification();
+        setStatusBarNotification(notification);
+
+        SmartActionsHelper.SmartSuggestions suggestions;
+        try {
+            suggestions = mSmartActionsHelper.suggest(createNotificationEntry());
+        } finally {
+            release.countDown();
+        }
+
+        assertThat(suggestions.replies).isEmpty();
+        assertThat(suggestions.actions).isEmpty();
+        assertThat(mSmartActionsHelper.getSuggestTimeoutCount()).isEqualTo(1);
+    }
+
     @Test
     public void testCopyAction() {
         Bundle extras = new Bundle();
@@ -0,0 +1,89 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static org.junit.Assert.assertEquals;
+import static org.mockito.ArgumentMatchers.anyInt;
+import static org.mockito.ArgumentMatchers.anyString;
+import static org.mockito.ArgumentMatchers.eq;
+import static org.mockito.Mockito.times;
+import static org.mockito.Mockito.verify;
+import static org.mockito.Mockito.when;
+
+import android.content.pm.ApplicationInfo;
+import android.content.pm.IPackageManager;
+import android.os.Build;
+import android.os.RemoteException;
+
+import org.junit.Before;
+import org.junit.Test;
+import org.mockito.Mock;
+import org.mockito.MockitoAnnotations;
+
+public class TargetSdkCacheTest {
+    @Mock
+    IPackageManager mPackageManager;
+
+    private TargetSdkCache mCache;
+
+    @Before
+    public void setUp() throws Exception {
+        MockitoAnnotations.initMocks(this);
+        ApplicationInfo info = new ApplicationInfo();
+        info.targetSdkVersion = Build.VERSION_CODES.P;
+        when(mPackageManager.getApplicationInfo(anyString(), anyInt(), anyInt()))
+                .thenReturn(info);
+        mCache = new TargetSdkCache(mPackageManager);
+    }
+
+    @Test
+    public void testLooksUpOnce() throws Exception {
+        assertEquals(Build.VERSION_CODES.P, mCache.getTargetSdk("pkg", 0));
+        assertEquals(Build.VERSION_CODES.P, mCache.getTargetSdk("pkg", 0));
+
+        verify(mPackageManager, times(1)).getApplicationInfo(eq("pkg"), anyInt(), eq(0));
+        assertEquals(1, mCache.getHitCount());
+        assertEquals(1, mCache.getMissCount());
+    }
+
+    @Test
+    public void testCachedPerUser() throws Exception {
+        mCache.getTargetSdk("pkg", 0);
+        mCache.getTargetSdk("pkg", 10);
+
+        verify(mPackageManager, times(1)).getApplicationInfo(eq("pkg"), anyInt(), eq(10));
+    }
+
+    @Test
+    public void testInvalidate() throws Exception {
+        mCache.getTargetSdk("pkg", 0);
+        mCache.invalidate("pkg", 0);
+        mCache.getTargetSdk("pkg", 0);
+
+        verify(mPackageManager, times(2)).getApplicationInfo(eq("pkg"), anyInt(), eq(0));
+    }
+
+    @Test
+    public void testFailuresAreNotCached() throws Exception {
+        when(mPackageManager.getApplicationInfo(eq("missing"), anyInt(), anyInt()))
+                .thenThrow(new RemoteException());
+
+        assertEquals(TargetSdkCache.UNKNOWN, mCache.getTargetSdk("missing", 0));
+        assertEquals(TargetSdkCache.UNKNOWN, mCache.getTargetSdk("missing", 0));
+        verify(mPackageManager, times(2)).getApplicationInfo(eq("missing"), anyInt(), eq(0));
+    }
+}
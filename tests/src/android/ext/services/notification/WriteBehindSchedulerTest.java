@@ -0,0 +1,117 @@
+/**
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package android.ext.services.notification;
+
+import static junit.framework.Assert.assertFalse;
+import static junit.framework.Assert.assertTrue;
+
+import static org.junit.Assert.assertEquals;
+
+import android.os.Handler;
+import android.os.HandlerThread;
+
+import org.junit.After;
+import org.junit.Before;
+import org.junit.Test;
+
+import java.util.concurrent.CountDownLatch;
+import java.util.concurrent.TimeUnit;
+import java.util.concurrent.atomic.AtomicInteger;
+
+public class WriteBehindSchedulerTest {
+    private HandlerThread mThread;
+    private Handler mHandler;
+    private final AtomicInteger mWrites = new AtomicInteger();
+
+    @Before
+    public void setUp() {
+        mThread = new HandlerThread("WriteBehindSchedulerTest");
+        mThread.start();
+        mHandler = new Handler(mThread.getLooper());
+    }
+
+    @After
+    public void tearDown() {
+        mThread.quitSafely();
+    }
+
+    @Test
+    public void testRequestsWithinWindowAreCoalesced() {
+        WriteBehindScheduler scheduler =
+                new WriteBehindScheduler(mHandler, mWrites::incrementAndGet, 60_000);
+
+        scheduler.markDirty();
+        scheduler.markDirty();
+        scheduler.markDirty();
+
+        assertTrue(scheduler.isDirty());
+        assertEquals(0, mWrites.get());
+        assertEquals(3, scheduler.getRequestedWriteCount());
+        assertEquals(2, scheduler.getCoalescedWriteCount());
+
+        scheduler.flush();
+
+        assertFalse(scheduler.isDirty());
+        assertEquals(1, mWrites.get());
+        assertEquals(1, scheduler.getExecutedWriteCount());
+    }
+
+    @Test
+    public void testFlushWithoutChangesDoesNotWrite() {
+        WriteBehindScheduler scheduler =
+                new WriteBehindScheduler(mHandler, mWrites::incrementAndGet, 60_000);
+
+        scheduler.flush();
+
+        assertEquals(0, mWrites.get());
+        assertEquals(0, scheduler.getExecutedWriteCount());
+    }
+
+    @Test
+    public void testWritesAfterWindow() throws Exception {
+        CountDownLatch latch = new CountDownLatch(1);
+        WriteBehindScheduler scheduler =
+                new WriteBehindScheduler(mHandler, latch::countDown, 10);
+
+        scheduler.markDirty();
+
+        assertTrue(latch.await(5, TimeUnit.SECONDS));
+        assertFalse(scheduler.isDirty());
+        assertEquals(1, scheduler.getExecutedWriteCount());
+    }
+
+    @Test
+    public void testRequestDuringWriteSchedulesAnotherWrite() {
+        WriteBehindScheduler[] scheduler = new WriteBehindScheduler[1];
+        scheduler[0] = new WriteBehindScheduler(mHandler, () -> {
+            if (mWrites.incrementAndGet() == 1) {
+                scheduler[0].markDirty();
+            }
+        }, 60_000);
+
+        scheduler[0].markDirty();
+        scheduler[0].flush();
+
+        assertEquals(1, mWrites.get());
+        assertTrue(scheduler[0].isDirty());
+
+        scheduler[0].flush();
+
+        assertEquals(2, mWrites.get());
+        assertEquals(0, scheduler[0].getCoalescedWriteCount());
+    }
+}